@@ -1,64 +1,206 @@
+/*
+ * Absolute Loader
+ *
+ * Loads an object program into a memory image sized from its H-record
+ * and writes the image out in one call: a compact hex dump on stdout,
+ * or the raw bytes to a file. T-record payloads are decoded a whole
+ * run at a time straight into the image by the vectorized decoder of
+ * hexdec.h, so large programs load at memory speed instead of one
+ * printf per byte.
+ *
+ * Usage: absloader [-l] [-b file] [objfile]
+ *   objfile  Text H^T^E or binary (sicobj.h) program (default objectcode.txt)
+ *   -l       Also print the classic per-byte listing (ADDR<tab>BYTE)
+ *   -b F     Write the raw memory image to F instead of the hex dump
+ *
+ * Text T-records may be written as "T^001000^1E<hex>" (as the assembler
+ * does) or with '^' between instructions and a trailing '$'.
+ */
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-void main()
+#include "hexdec.h"
+#include "loadutil.h"
+#include "sicobj.h"
+
+// Decode one T-record (without its newline) into the image
+// Returns 0, or -1 if it is malformed, lies outside the program or
+// holds a different number of bytes than its length field says
+int load_trecord(struct SicObj *obj, const char *p, const char *end, int line_no)
 {
-    FILE *fp;
-    int i, j, staddr1;
-    char name[10], line[50], name1[10], staddr[10];
+    int addr, len, off;
 
-    printf("Enter program name: ");
-    scanf("%s", name);
+    if (end - p < 11 || p[1] != '^' || p[8] != '^' || (addr = hex_field(p + 2, 6)) < 0 ||
+        (len = hex_field(p + 9, 2)) < 0) {
+        printf("Error: Bad T-record (line %d)\n", line_no);
+        return -1;
+    }
+    off = addr - obj->start;
+    p += 11;
 
-    fp = fopen("objectcode.txt", "r");
-    if (fp == NULL) {
-        printf("Error opening file.\n");
-        exit(1);
+    // Decode each run of digits between separators in one go
+    while (p < end && *p != '$') {
+        const char *run = p;
+        int n;
+
+        if (*p == '^') {
+            p++;
+            continue;
+        }
+        while (p < end && *p != '^' && *p != '$' && *p != ' ' && *p != '\t' && *p != '\r')
+            p++;
+        n = (p - run) / 2;
+        if (off < 0 || off + n > obj->length) {
+            printf("Error: T-record at %06X lies outside the program (line %d)\n", addr,
+                   line_no);
+            return -1;
+        }
+        if ((p - run) % 2 != 0 || hex_decode(obj->image + off, run, n) < 0) {
+            printf("Error: Bad hex in T-record (line %d)\n", line_no);
+            return -1;
+        }
+        off += n;
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+            p++;
     }
+    if (off - (addr - obj->start) != len) {
+        printf("Error: T-record length %02X but %d byte(s) of data (line %d)\n", len,
+               off - (addr - obj->start), line_no);
+        return -1;
+    }
+    return 0;
+}
 
-    fscanf(fp, "%s", line); 
+// Load a text H^T^E program into obj (same layout as a binary one)
+// Returns 0 on success, -1 on errors
+int load_text(const char *filename, struct SicObj *obj)
+{
+    char *buf;
+    long size = read_file(filename, &buf);
+    int line_no = 0, status = 0;
 
-    if (line[0] != 'H') {
-        printf("Invalid object program format.\n");
-        fclose(fp);
-        return;
+    memset(obj, 0, sizeof(*obj));
+    if (size < 0) {
+        printf("Error opening file.\n");
+        return -1;
     }
 
-    for (i = 2, j = 0; i < 8 && j < 6; i++, j++)
-        name1[j] = line[i];
-    name1[j] = '\0';
-
-    printf("Program name from object file: %s\n", name1);
-
-    if (strcmp(name, name1) == 0) {
-        while (fscanf(fp, "%s", line) != EOF) {
-            if (line[0] == 'T') {
-            
-                for (i = 2, j = 0; i < 8 && j < 6; i++, j++)
-                    staddr[j] = line[i];
-                staddr[j] = '\0';
-
-                staddr1 = (int)strtol(staddr, NULL, 16); 
-
-                i = 12;
-                while (line[i] != '$' && line[i] != '\0') {
-                    if (line[i] != '^') {
-                        printf("00%04X\t%c%c\n", staddr1, line[i], line[i + 1]);
-                        staddr1++;
-                        i += 2;
-                    } else {
-                        i++;
-                    }
-                }
-            } else if (line[0] == 'E') {
-                printf("\nEnd of program.\n");
+    for (const char *p = buf, *end = buf + size; p < end;) {
+        const char *eol = memchr(p, '\n', end - p);
+        const char *next = eol ? eol + 1 : end;
+        if (eol == NULL)
+            eol = end;
+        line_no++;
+
+        if (line_no == 1) {
+            // H^NAME  ^SSSSSS^LLLLLL
+            if (eol - p < 22 || p[0] != 'H' || p[1] != '^' || p[8] != '^' || p[15] != '^' ||
+                (obj->start = hex_field(p + 9, 6)) < 0 ||
+                (obj->length = hex_field(p + 16, 6)) < 0) {
+                printf("Invalid object program format.\n");
+                status = -1;
                 break;
             }
+            memcpy(obj->name, p + 2, 6);
+            obj->name[6] = '\0';
+            for (int i = 5; i >= 0 && obj->name[i] == ' '; i--)
+                obj->name[i] = '\0';
+            obj->entry = obj->start;
+            obj->image = calloc(obj->length + 1, 1);
+        } else if (p[0] == 'T') {
+            if ((status = load_trecord(obj, p, eol, line_no)) < 0)
+                break;
+        } else if (p[0] == 'E') {
+            if (eol - p >= 8 && p[1] == '^' && (obj->entry = hex_field(p + 2, 6)) < 0)
+                obj->entry = obj->start;
+            break;
         }
-    } else {
+        p = next;
+    }
+    if (line_no == 0) {
+        printf("Invalid object program format.\n");
+        status = -1;
+    }
+
+    free(buf);
+    if (status < 0) {
+        free(obj->image);
+        obj->image = NULL;
+    }
+    return status;
+}
+
+// The classic listing: one "00ADDR<tab>BYTE" line per byte
+void write_listing(const struct SicObj *obj, FILE *fp)
+{
+    char *out = malloc((size_t)obj->length * 16 + 1);
+    char *q = out;
+
+    for (int i = 0; i < obj->length; i++)
+        q += sprintf(q, "00%04X\t%02X\n", obj->start + i, obj->image[i]);
+    fwrite(out, 1, q - out, fp);
+    free(out);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *filename = "objectcode.txt", *image_file = NULL;
+    struct SicObj obj;
+    char name[10];
+    int listing = 0, status = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-l") == 0) {
+            listing = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            image_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printf("Usage: %s [-l] [-b file] [objfile]\n", argv[0]);
+            return 1;
+        } else {
+            filename = argv[i];
+        }
+    }
+
+    printf("Enter program name: ");
+    if (scanf("%9s", name) != 1)
+        return 1;
+
+    if (sicobj_is_binary(filename)) {
+        if (sicobj_read(filename, &obj) < 0) {
+            printf("Invalid object program format.\n");
+            return 1;
+        }
+    } else if (load_text(filename, &obj) < 0) {
+        return 1;
+    }
+
+    printf("Program name from object file: %s\n", obj.name);
+    if (strcmp(name, obj.name) != 0) {
         printf("Program name does not match.\n");
+        sicobj_free(&obj);
+        return 1;
+    }
+    printf("Loaded %d bytes at %06X, entry %06X\n", obj.length, obj.start, obj.entry);
+    fflush(stdout);
+
+    if (listing)
+        write_listing(&obj, stdout);
+    if (image_file != NULL) {
+        FILE *fp = fopen(image_file, "wb");
+        if (fp == NULL || fwrite(obj.image, 1, obj.length, fp) != (size_t)obj.length) {
+            printf("Error: Cannot write %s\n", image_file);
+            status = 1;
+        }
+        if (fp)
+            fclose(fp);
+    } else {
+        write_hex_dump(obj.image, obj.start, obj.length, stdout);
     }
+    printf("\nEnd of program.\n");
 
-    fclose(fp);
+    sicobj_free(&obj);
+    return status;
 }
@@ -0,0 +1,267 @@
+/*
+ * Two-Pass Assembler Driver
+ *
+ * Runs Pass 1 and Pass 2 in one process over the in-memory line
+ * records of asmcore.h, with no intermediate files in between.
+ *
+ * Usage: asm [-d] [-1] [-b] [-M] [-j threads] [-i state] [--stats file] [source]
+ *        asm -m manifest [-1] [-b] [-j threads]
+ *   source  Source program (default: input.txt)
+ *   -d      Also write intermediate.txt, symtab.txt and length.txt
+ *           (not with -1)
+ *   -1      One-pass load-and-go mode: object code is emitted while
+ *           the source is read and forward references are patched
+ *           when their labels are defined (no listing is produced)
+ *   -j N    Encode pass 2 on N threads (output is identical for any N)
+ *   -b      Also write the binary object program object_program.bin
+ *           (not with -1, which has no pass 2 to write it)
+ *   -M      Expand macros (macro.h) while pass 1 reads the source; the
+ *           expanded program is never written out or read back
+ *   -i F    Incremental: keep the assembly in state file F and on the
+ *           next run resume after the unchanged part of the source,
+ *           patching listing.txt and object_program.txt in place
+ *           (asminc.h); -1, -b, -M and -m are rejected
+ *   -m F    Batch: assemble every source listed in F in this process,
+ *           one module per thread (asmbatch.h); -j sets the number of
+ *           threads (default: all CPUs). Errors are prefixed with the
+ *           module's source file; -d, -M and --stats are rejected
+ *   --stats F  Write a JSON report to F ("-" for stdout, which moves the
+ *           progress and error messages to stderr): wall and CPU
+ *           time per phase, OPTAB/SYMTAB lookups, SYMTAB probe lengths,
+ *           bytes read and written, T-records (asmstats.h)
+ *
+ * Opcodes come from the generated optab_gen.h.
+ * Produces listing.txt and object_program.txt.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "asmcore.h"
+#include "asmbatch.h"
+#include "asminc.h"
+#include "asmstats.h"
+#include "macro.h"
+
+// Write the --stats report; returns 0 on success
+int write_stats(const char *stats_file, const struct Assembly *as, const char *source,
+                const char **phases, const struct PhaseMark *marks, int nphases,
+                long bytes_written) {
+    FILE *fp = strcmp(stats_file, "-") == 0 ? stdout : fopen(stats_file, "w");
+
+    if (fp == NULL) {
+        printf("Warning: Cannot write %s\n", stats_file);
+        return -1;
+    }
+    stats_write_json(fp, as, source, phases, marks, nphases, bytes_written);
+    if (fp != stdout)
+        fclose(fp);
+    return 0;
+}
+
+// Batch mode: assemble every module of a manifest
+int run_batch(const char *manifest, int one_pass, int binary, int nthreads) {
+    struct Batch b;
+    struct timespec t0, t1;
+    int failed;
+
+    if (batch_load(&b, manifest) < 0) {
+        printf("Error: Cannot open %s\n", manifest);
+        return 1;
+    }
+    b.one_pass = one_pass;
+    b.binary = binary;
+    if (nthreads < 1)
+        nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    failed = batch_run(&b, nthreads);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    for (int i = 0; i < b.nsources; i++)
+        if (b.status[i] != 0)
+            printf("%s: %s\n", b.sources[i], b.status[i] < 0 ? "not assembled" : "errors found");
+    printf("Batch: %d module(s), %d failed, %d thread(s), %.3f s\n", b.nsources, failed,
+           b.nworkers, (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+    batch_free(&b);
+    return failed > 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *source = "input.txt", *manifest = NULL, *stats_file = NULL, *state_file = NULL;
+    struct PhaseMark marks[3];
+    long bytes_written = 0;
+    int debug = 0, one_pass = 0, binary = 0, macros = 0, nthreads = 0;
+    FILE *f_list, *f_obj, *f_bin = NULL, *msg = stdout;
+    struct Lexer lx;
+    struct Assembly as;
+    struct MacroStream ms;
+    struct LineSource src = { mac_stream_read, &ms };
+    struct IncState inc;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            debug = 1;
+        } else if (strcmp(argv[i], "-1") == 0) {
+            one_pass = 1;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            binary = 1;
+        } else if (strcmp(argv[i], "-M") == 0) {
+            macros = 1;
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-i") == 0 && i + 1 < argc) {
+            state_file = argv[++i];
+        } else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+            manifest = argv[++i];
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printf("Usage: %s [-d] [-1] [-b] [-M] [-j threads] [-i state]"
+                   " [--stats file] [source]\n", argv[0]);
+            printf("       %s -m manifest [-1] [-b] [-j threads]\n", argv[0]);
+            return 1;
+        } else {
+            source = argv[i];
+        }
+    }
+
+    if (one_pass && (debug || binary)) {
+        printf("Error: -d and -b cannot be used with -1\n");
+        return 1;
+    }
+    if (state_file != NULL && (one_pass || binary || macros || manifest != NULL)) {
+        printf("Error: -1, -b, -M and -m cannot be used with -i\n");
+        return 1;
+    }
+    if (manifest != NULL) {
+        if (debug || macros || stats_file != NULL) {
+            printf("Error: -d, -M and --stats cannot be used with -m\n");
+            return 1;
+        }
+        return run_batch(manifest, one_pass, binary, nthreads);
+    }
+    if (nthreads < 1)
+        nthreads = 1;
+    // With --stats - stdout carries only the JSON report
+    if (stats_file != NULL && strcmp(stats_file, "-") == 0)
+        msg = stderr;
+
+    phase_mark(&marks[0]);
+    if (lex_open(&lx, source) < 0) {
+        fprintf(msg, "Error: Cannot open %s\n", source);
+        return 1;
+    }
+    asm_init(&as);
+    as.diag = msg;
+    if (macros) {
+        mac_stream_init(&ms, &lx, asm_is_opcode, XC_DEFAULT_BUDGET);
+        ms.diag = msg;
+        as.source = &src;
+    }
+
+    if (one_pass) {
+        f_obj = fopen("object_program.txt", "w");
+        if (f_obj == NULL) {
+            fprintf(msg, "Error: Cannot create object_program.txt\n");
+            return 1;
+        }
+        asm_one_pass(&as, &lx, f_obj);
+        lex_close(&lx);
+        if (macros) {
+            as.error_flag |= ms.error_flag;
+        as.stats.optab_lookups += ms.opcode_lookups;
+            mac_stream_free(&ms);
+        }
+        bytes_written = ftell(f_obj);
+        fclose(f_obj);
+        phase_mark(&marks[1]);
+        fprintf(msg, "One-pass assembly complete. Program Length: %X\n", as.prog_length);
+        if (stats_file != NULL) {
+            const char *phases[] = { "one_pass" };
+            write_stats(stats_file, &as, source, phases, marks, 1, bytes_written);
+        }
+        if (as.error_flag)
+            fprintf(msg, "Errors found. Check output.\n");
+        asm_free(&as);
+        return as.error_flag;
+    }
+
+    // Pass 1
+    if (state_file != NULL)
+        inc_pass1(&inc, &as, &lx, state_file);
+    else
+        asm_pass1(&as, &lx);
+    lex_close(&lx);
+    if (macros) {
+        fprintf(msg, "Macros: %d defined, %ld call(s) expanded"
+                " (cache: %ld hit(s), %ld miss(es))\n",
+                ms.mt.nmacros, ms.calls, ms.cache.hits, ms.cache.misses);
+        as.error_flag |= ms.error_flag;
+        as.stats.optab_lookups += ms.opcode_lookups;
+        mac_stream_free(&ms);
+    }
+    phase_mark(&marks[1]);
+    fprintf(msg, "Pass 1 complete. Program Length: %X\n", as.prog_length);
+
+    if (debug) {
+        FILE *f_inter = fopen("intermediate.txt", "w");
+        FILE *f_symtab = fopen("symtab.txt", "w");
+        FILE *f_length = fopen("length.txt", "w");
+        if (f_inter && f_symtab && f_length)
+            asm_write_intermediate(&as, f_inter, f_symtab, f_length);
+        if (f_inter) fclose(f_inter);
+        if (f_symtab) fclose(f_symtab);
+        if (f_length) fclose(f_length);
+    }
+
+    // Pass 2
+    if (state_file != NULL) {
+        if ((bytes_written = inc_pass2(&inc, &as, nthreads)) < 0) {
+            fprintf(msg, "Error: Cannot create listing.txt or object_program.txt\n");
+            return 1;
+        }
+        if (inc.resume >= 0)
+            fprintf(msg, "Incremental: resumed at line %d of %d, %d earlier line(s)"
+                    " re-encoded\n", as.ckpts[inc.resume].nlines, as.nlines, inc.reencoded);
+        else
+            fprintf(msg, "Incremental: no usable state, assembled in full\n");
+        if (inc_save(&inc, &as, state_file) < 0)
+            fprintf(msg, "Warning: Cannot write %s\n", state_file);
+        inc_free(&inc);
+    } else {
+        f_list = fopen("listing.txt", "w");
+        f_obj = fopen("object_program.txt", "w");
+        if (!f_list || !f_obj) {
+            fprintf(msg, "Error: Cannot create listing.txt or object_program.txt\n");
+            return 1;
+        }
+        if (binary && (f_bin = fopen("object_program.bin", "wb")) == NULL) {
+            fprintf(msg, "Error: Cannot create object_program.bin\n");
+            return 1;
+        }
+        asm_pass2(&as, f_list, f_obj, f_bin, nthreads);
+        bytes_written = ftell(f_list) + ftell(f_obj) + (f_bin ? ftell(f_bin) : 0);
+        fclose(f_list);
+        fclose(f_obj);
+        if (f_bin)
+            fclose(f_bin);
+    }
+    phase_mark(&marks[2]);
+
+    fprintf(msg, "Pass 2 complete.\n");
+    if (as.error_flag)
+        fprintf(msg, "Errors found. Check output.\n");
+    else
+        fprintf(msg, "Object program written to 'object_program.txt'\n");
+    if (stats_file != NULL) {
+        const char *phases[] = { "pass1", "pass2" };
+        write_stats(stats_file, &as, source, phases, marks, 2, bytes_written);
+    }
+
+    asm_free(&as);
+    return as.error_flag;
+}
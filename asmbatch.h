@@ -0,0 +1,243 @@
+/*
+ * Batch assembly of many modules in one process
+ *
+ * A manifest lists one source file per line (blank lines and lines
+ * starting with '#' are skipped). Every module gets its own Assembly,
+ * so SYMTABs never mix, and its own outputs next to the source:
+ * foo.asm -> foo.lst, foo.obj (and foo.bin when binary output is on).
+ *
+ * Modules are assembled on a pool of threads. Each worker starts with
+ * a contiguous share of the manifest and takes modules from its front;
+ * a worker that runs dry steals the back half of another worker's
+ * remaining share, so a few large modules do not leave threads idle.
+ *
+ * Each module's errors are prefixed with its source file and collected
+ * in memory, then written out in one piece when the module is done, so
+ * messages from different threads never interleave.
+ */
+
+#ifndef ASMBATCH_H
+#define ASMBATCH_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "asmcore.h"
+
+struct BatchWorker {
+    pthread_mutex_t lock;
+    int next, end;     // Modules [next, end) not yet started
+    int done;          // Modules assembled by this worker
+    int stolen;        // Modules taken from other workers
+};
+
+struct Batch {
+    char **sources;
+    int nsources;
+    int one_pass;
+    int binary;        // Also write foo.bin (never with one_pass)
+    int *status;       // Per module: 0 ok, 1 assembly errors, -1 I/O error
+    struct BatchWorker *workers;
+    int nworkers;
+};
+
+struct BatchArg {
+    struct Batch *b;
+    int id;
+};
+
+// Read a manifest; returns the number of sources, or -1 if it cannot be opened
+static inline int batch_load(struct Batch *b, const char *manifest) {
+    char line[4096];
+    int cap = 64;
+    FILE *fp = fopen(manifest, "r");
+
+    memset(b, 0, sizeof(*b));
+    if (fp == NULL)
+        return -1;
+    b->sources = malloc(cap * sizeof(char *));
+    while (fgets(line, sizeof(line), fp) != NULL) {
+        int len = strcspn(line, "\r\n");
+        int start = strspn(line, " \t");
+        line[len] = '\0';
+        while (len > start && (line[len - 1] == ' ' || line[len - 1] == '\t'))
+            line[--len] = '\0';
+        if (len == start || line[start] == '#')
+            continue;
+        if (b->nsources == cap) {
+            cap *= 2;
+            b->sources = realloc(b->sources, cap * sizeof(char *));
+        }
+        b->sources[b->nsources++] = strdup(line + start);
+    }
+    fclose(fp);
+    return b->nsources;
+}
+
+static inline void batch_free(struct Batch *b) {
+    for (int i = 0; i < b->nsources; i++)
+        free(b->sources[i]);
+    free(b->sources);
+    free(b->status);
+    free(b->workers);
+    memset(b, 0, sizeof(*b));
+}
+
+// Output file name: the source with its extension replaced by 'ext'
+static inline void batch_output_name(char *out, int size, const char *source, const char *ext) {
+    const char *slash = strrchr(source, '/');
+    const char *dot = strrchr(source, '.');
+    int len = strlen(source);
+
+    if (dot != NULL && (slash == NULL || dot > slash) && dot != source)
+        len = dot - source;
+    snprintf(out, size, "%.*s%s", len, source, ext);
+}
+
+// Assemble one module; returns 0, 1 on assembly errors or -1 on I/O errors
+static inline int batch_assemble(const struct Batch *b, const char *source) {
+    char list_name[4200], obj_name[4200], bin_name[4200];
+    FILE *f_list = NULL, *f_obj, *f_bin = NULL;
+    struct Lexer lx;
+    struct Assembly as;
+    char *diag = NULL;
+    size_t diag_len = 0;
+    int status;
+
+    batch_output_name(list_name, sizeof(list_name), source, ".lst");
+    batch_output_name(obj_name, sizeof(obj_name), source, ".obj");
+    batch_output_name(bin_name, sizeof(bin_name), source, ".bin");
+
+    if (lex_open(&lx, source) < 0) {
+        printf("Error: Cannot open %s\n", source);
+        return -1;
+    }
+    f_obj = fopen(obj_name, "w");
+    if (!b->one_pass)
+        f_list = fopen(list_name, "w");
+    if (b->binary)
+        f_bin = fopen(bin_name, "wb");
+    if (f_obj == NULL || (!b->one_pass && f_list == NULL) || (b->binary && f_bin == NULL)) {
+        printf("Error: Cannot create the outputs of %s\n", source);
+        if (f_obj) fclose(f_obj);
+        if (f_list) fclose(f_list);
+        if (f_bin) fclose(f_bin);
+        lex_close(&lx);
+        return -1;
+    }
+
+    asm_init(&as);
+    as.diag = open_memstream(&diag, &diag_len);
+    as.diag_name = source;
+    if (b->one_pass) {
+        asm_one_pass(&as, &lx, f_obj);
+    } else {
+        asm_pass1(&as, &lx);
+        asm_pass2(&as, f_list, f_obj, f_bin, 1);
+    }
+    lex_close(&lx);
+    status = as.error_flag ? 1 : 0;
+    if (as.diag != NULL) {
+        fclose(as.diag);
+        fwrite(diag, 1, diag_len, stdout);  // One locked write per module
+        free(diag);
+    }
+    asm_free(&as);
+
+    fclose(f_obj);
+    if (f_list) fclose(f_list);
+    if (f_bin) fclose(f_bin);
+    return status;
+}
+
+// Next module for worker 'id', stealing when its own share is used up
+// Returns -1 when no work is left anywhere
+static inline int batch_take(struct Batch *b, int id) {
+    struct BatchWorker *w = &b->workers[id];
+    int m = -1;
+
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end)
+        m = w->next++;
+    pthread_mutex_unlock(&w->lock);
+    if (m >= 0)
+        return m;
+
+    for (int k = 1; k < b->nworkers; k++) {
+        struct BatchWorker *v = &b->workers[(id + k) % b->nworkers];
+        int lo = 0, hi = 0;
+
+        pthread_mutex_lock(&v->lock);
+        if (v->end > v->next) {
+            hi = v->end;
+            lo = v->end - (v->end - v->next + 1) / 2;
+            v->end = lo;
+        }
+        pthread_mutex_unlock(&v->lock);
+        if (hi > lo) {
+            pthread_mutex_lock(&w->lock);
+            w->next = lo + 1;
+            w->end = hi;
+            w->stolen += hi - lo;
+            pthread_mutex_unlock(&w->lock);
+            return lo;
+        }
+    }
+    return -1;
+}
+
+static inline void *batch_worker(void *p) {
+    struct BatchArg *arg = p;
+    struct Batch *b = arg->b;
+    int m;
+
+    while ((m = batch_take(b, arg->id)) >= 0) {
+        b->status[m] = batch_assemble(b, b->sources[m]);
+        b->workers[arg->id].done++;
+    }
+    return NULL;
+}
+
+// Assemble every module of the batch on 'nthreads' workers
+// Returns the number of modules that failed
+static inline int batch_run(struct Batch *b, int nthreads) {
+    pthread_t *tids;
+    struct BatchArg *args;
+    int failed = 0;
+
+    if (nthreads > b->nsources)
+        nthreads = b->nsources;
+    if (nthreads < 1)
+        nthreads = 1;
+    b->nworkers = nthreads;
+    b->status = calloc(b->nsources + 1, sizeof(int));
+    b->workers = calloc(nthreads, sizeof(struct BatchWorker));
+    tids = malloc(nthreads * sizeof(pthread_t));
+    args = malloc(nthreads * sizeof(struct BatchArg));
+
+    // Contiguous initial shares
+    for (int t = 0; t < nthreads; t++) {
+        pthread_mutex_init(&b->workers[t].lock, NULL);
+        b->workers[t].next = (long)b->nsources * t / nthreads;
+        b->workers[t].end = (long)b->nsources * (t + 1) / nthreads;
+        args[t].b = b;
+        args[t].id = t;
+    }
+    for (int t = 1; t < nthreads; t++)
+        pthread_create(&tids[t], NULL, batch_worker, &args[t]);
+    batch_worker(&args[0]);
+    for (int t = 1; t < nthreads; t++)
+        pthread_join(tids[t], NULL);
+
+    for (int t = 0; t < nthreads; t++)
+        pthread_mutex_destroy(&b->workers[t].lock);
+    for (int i = 0; i < b->nsources; i++)
+        failed += b->status[i] != 0;
+    free(tids);
+    free(args);
+    return failed;
+}
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Assembler Throughput Benchmark
+ *
+ * Generates a synthetic SIC program in memory and assembles it with the
+ * shared passes of asmcore.h, timing Pass 1, Pass 2 and the whole run.
+ * Reports lines/sec for each phase and the peak resident set size, so
+ * throughput regressions can be tracked from run to run.
+ *
+ * Usage: asmbench [-n lines] [-s symbols] [-f forward%] [-d data%]
+ *                 [-r repeats] [-j threads] [-seed N] [-o file]
+ *   -n N     Source lines to generate (default 100000; 1k-10M is sensible)
+ *   -s N     Number of labels (default lines / 10)
+ *   -f P     Percent of operands that are forward references (default 30)
+ *   -d P     Percent of BYTE/WORD/RESW/RESB lines (default 20)
+ *   -r N     Repeat the measurement N times and keep the best (default 3)
+ *   -j N     Encode pass 2 on N threads (default 1)
+ *   -seed N  Seed of the generator, for reproducible sources
+ *   -o F     Write the generated source to F and exit (no timing)
+ *
+ * The listing and object program go to /dev/null, so the timings cover
+ * formatting and writing but not the disk.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "asmcore.h"
+
+struct SourceBuf {
+    char *p;
+    size_t len, cap;
+};
+
+static const char *bench_ops[] = { "LDA", "ADD", "SUB", "STA", "COMP", "JEQ", "JLT", "LDX", "STX", "TIX" };
+
+// xorshift32; deterministic for a given seed
+unsigned next_rand(unsigned *state) {
+    unsigned x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+void src_printf(struct SourceBuf *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+void src_printf(struct SourceBuf *b, const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    if (b->cap - b->len < 128) {
+        b->cap = b->cap ? b->cap * 2 : 1 << 20;
+        b->p = realloc(b->p, b->cap);
+    }
+    va_start(ap, fmt);
+    n = vsnprintf(b->p + b->len, b->cap - b->len, fmt, ap);
+    va_end(ap);
+    b->len += n;
+}
+
+// Build a program of 'nlines' statements with 'nsyms' labels spread
+// evenly over it; 'fwd_pct' of the operands name a label defined later
+void generate_source(struct SourceBuf *b, int nlines, int nsyms, int fwd_pct, int data_pct,
+                     unsigned seed) {
+    int step = nsyms > 0 ? nlines / nsyms : nlines + 1;
+    int defined = 0;
+
+    if (step < 1)
+        step = 1;
+    src_printf(b, "BENCH   START   1000\n");
+    for (int i = 0; i < nlines; i++) {
+        char label[16] = "-";
+        int r = next_rand(&seed) % 100;
+
+        if (i % step == 0 && defined < nsyms)
+            snprintf(label, sizeof(label), "S%d", defined++);
+
+        if (r < data_pct) {
+            switch (next_rand(&seed) % 4) {
+            case 0: src_printf(b, "%s\tWORD\t%u\n", label, next_rand(&seed) % 4096); break;
+            case 1: src_printf(b, "%s\tBYTE\tX'%02X'\n", label, next_rand(&seed) % 256); break;
+            case 2: src_printf(b, "%s\tBYTE\tC'EOF'\n", label); break;
+            default: src_printf(b, "%s\tRESW\t%u\n", label, 1 + next_rand(&seed) % 4); break;
+            }
+            continue;
+        }
+
+        const char *op = bench_ops[next_rand(&seed) % (sizeof(bench_ops) / sizeof(bench_ops[0]))];
+        int sym;
+        if (nsyms == 0) {
+            src_printf(b, "%s\t%s\t#%u\n", label, op, next_rand(&seed) % 4096);
+            continue;
+        }
+        if (defined == 0 || (defined < nsyms && (int)(next_rand(&seed) % 100) < fwd_pct))
+            sym = defined + next_rand(&seed) % (nsyms - defined); // Forward reference
+        else
+            sym = next_rand(&seed) % defined;
+        src_printf(b, "%s\t%s\tS%d\n", label, op, sym);
+    }
+    src_printf(b, "        END     1000\n");
+}
+
+double now_sec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[]) {
+    int nlines = 100000, nsyms = -1, fwd_pct = 30, data_pct = 20, repeats = 3, nthreads = 1;
+    unsigned seed = 12345;
+    const char *out_file = NULL;
+    double best_p1 = 1e30, best_p2 = 1e30, best_total = 1e30;
+    struct SourceBuf src = { 0 };
+    struct rusage ru;
+    int error_flag = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            nlines = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            nsyms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-f") == 0 && i + 1 < argc) {
+            fwd_pct = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            data_pct = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) {
+            repeats = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            nthreads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+            seed = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            out_file = argv[++i];
+        } else {
+            printf("Usage: %s [-n lines] [-s symbols] [-f forward%%] [-d data%%] [-r repeats]"
+                   " [-j threads] [-seed N] [-o file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (nlines < 1 || repeats < 1 || seed == 0) {
+        printf("Error: lines and repeats must be positive, seed non-zero\n");
+        return 1;
+    }
+    if (nsyms < 0 || nsyms > nlines)
+        nsyms = nsyms < 0 ? nlines / 10 : nlines;
+
+    // 1. Generate the source
+    double t0 = now_sec();
+    generate_source(&src, nlines, nsyms, fwd_pct, data_pct, seed);
+    printf("Generated %d lines, %d symbols (%.1f MB) in %.3f s\n", nlines, nsyms,
+           src.len / 1048576.0, now_sec() - t0);
+
+    if (out_file != NULL) {
+        FILE *fp = fopen(out_file, "w");
+        if (fp == NULL) {
+            printf("Error: Cannot create %s\n", out_file);
+            return 1;
+        }
+        fwrite(src.p, 1, src.len, fp);
+        fclose(fp);
+        printf("Source written to '%s'\n", out_file);
+        free(src.p);
+        return 0;
+    }
+
+    // 2. Assemble it 'repeats' times, keeping the best time of each phase
+    for (int r = 0; r < repeats; r++) {
+        struct Assembly as;
+        struct Lexer lx;
+        FILE *f_list = fopen("/dev/null", "w");
+        FILE *f_obj = fopen("/dev/null", "w");
+
+        if (!f_list || !f_obj) {
+            printf("Error: Cannot open /dev/null\n");
+            return 1;
+        }
+        double start = now_sec();
+        asm_init(&as);
+        lex_init_buffer(&lx, src.p, src.len);
+        asm_pass1(&as, &lx);
+        double mid = now_sec();
+        asm_pass2(&as, f_list, f_obj, NULL, nthreads);
+        fflush(f_list);
+        fflush(f_obj);
+        double end = now_sec();
+        error_flag = as.error_flag;
+        asm_free(&as);
+        double total = now_sec() - start;
+
+        fclose(f_list);
+        fclose(f_obj);
+        if (mid - start < best_p1) best_p1 = mid - start;
+        if (end - mid < best_p2) best_p2 = end - mid;
+        if (total < best_total) best_total = total;
+    }
+
+    // 3. Report
+    getrusage(RUSAGE_SELF, &ru);
+    printf("Best of %d run(s), %d thread(s):\n", repeats, nthreads);
+    printf("  Pass 1      %9.3f ms  %12.0f lines/sec\n", best_p1 * 1e3, nlines / best_p1);
+    printf("  Pass 2      %9.3f ms  %12.0f lines/sec\n", best_p2 * 1e3, nlines / best_p2);
+    printf("  End-to-end  %9.3f ms  %12.0f lines/sec\n", best_total * 1e3, nlines / best_total);
+    printf("  Peak RSS    %9.1f MB\n", ru.ru_maxrss / 1024.0);
+    if (error_flag)
+        printf("Errors found in the generated program.\n");
+
+    free(src.p);
+    return error_flag;
+}
@@ -0,0 +1,1415 @@
+/*
+ * Core of the two-pass SIC assembler
+ *
+ * Pass 1 tokenizes the mapped source (asmlex.h) into a compact
+ * in-memory array of line records (LOCCTR, opcode id, operand symbol
+ * id) and builds SYMTAB.
+ * Pass 2 walks that array directly to produce the listing and the
+ * H-T-E object program, so no text round-trip is needed between the
+ * passes. The classic intermediate.txt / symtab.txt / length.txt files
+ * can still be written from (and read back into) the same records.
+ *
+ * In one-pass (load-and-go) mode the pass 1 loop also emits each
+ * line's object code into a memory image as it is read. References to
+ * labels not yet defined are chained per symbol and patched in place
+ * when the label is defined, so the H-T-E records come out of a single
+ * pass over the source.
+ *
+ * Pass 2 encodes the lines on worker threads and merges the results
+ * in line order (build with -pthread). It can also write the binary
+ * object format of sicobj.h next to the text program.
+ *
+ * For incremental reassembly (asminc.h) pass 1 can save a checkpoint
+ * every few thousand lines and resume from one, and pass 2 records
+ * where each line's object code went and can resume output at a
+ * checkpoint.
+ *
+ * Opcodes come from the generated SIC/XE table in optab_gen.h (formats
+ * 1-3 plus +format 4); no opcode file is read at run time.
+ *
+ * Operands may be expressions (SYM+4, A-B, *-3). Symbols defined by
+ * EQU are nodes pointing at their expression: they are resolved on
+ * first use (or at the end of pass 1) depth first, with an explicit
+ * stack, so any definition order still takes two linear passes.
+ * Circular definitions are reported. ORG moves LOCCTR; a bare ORG
+ * restores it.
+ *
+ * Literals (=C'EOF', =X'05') are named by their bytes (=X'454F46'), so
+ * every spelling of the same constant shares one SYMTAB entry. LITTAB
+ * keeps them in order of first use; LTORG and END place the literals
+ * not yet in a pool as BYTE lines labelled with that name.
+ *
+ * Used by asm.c (fused driver), pass1.c and pass2.c.
+ */
+
+#ifndef ASMCORE_H
+#define ASMCORE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+#include "asmtab.h"
+#include "optab_gen.h"
+#include "asmlex.h"
+#include "sicobj.h"
+#include "trecord.h"
+
+// Opcode ids: values >= 0 are slots of the generated OPTAB, with
+// OP_EXTENDED set for +format 4; directives are < 0
+enum {
+    OP_START = -1,
+    OP_END = -2,
+    OP_WORD = -3,
+    OP_BYTE = -4,
+    OP_RESW = -5,
+    OP_RESB = -6,
+    OP_INVALID = -7,
+    OP_EQU = -8,
+    OP_ORG = -9,
+    OP_LTORG = -10
+};
+#define OP_EXTENDED 0x1000
+
+// Addressing of format 3/4 operands: plain, #immediate, @indirect
+enum {
+    ADDR_SIMPLE,
+    ADDR_IMMEDIATE,
+    ADDR_INDIRECT
+};
+
+// One parsed source line
+struct AsmLine {
+    int locctr;
+    int op;     // Opcode id (see above)
+    int label;  // SYMTAB id of the label, or -1
+    int sym;    // SYMTAB id of the operand symbol, or -1
+    int value;  // WORD constant / RESW, RESB count / format 2 r1r2 byte /
+                // #constant
+    int mode;   // ADDR_* of a format 3/4 operand
+    int expr;   // Operand expression id (EQU, ORG, A+4 ...), or -1
+    int text;   // Offset of "label\0opcode\0operand\0" in the text pool
+};
+
+// One term of an expression: sign * (symbol value or constant)
+struct ExprTerm {
+    int sign;   // +1 or -1
+    int sym;    // SYMTAB id, or -1 for a constant
+    int value;  // Constant ('*' is the line's LOCCTR)
+    int rel;    // Constant is an address ('*')
+};
+
+struct AsmExpr {
+    int first;  // First term in the term pool
+    int n;
+};
+
+// Resolution state of a symbol
+enum {
+    SYM_PLAIN,     // Label, resolved EQU or undefined: value is in SYMTAB
+    SYM_PENDING,   // EQU not evaluated yet
+    SYM_ACTIVE     // EQU on the resolution stack
+};
+
+struct SymInfo {
+    int expr;     // Defining expression of an EQU, or -1
+    int state;    // SYM_*
+    int rel;      // 1 for an address (relocatable), 0 for an absolute value
+    int defined;  // The SYMTAB value is set (any value, -1 included)
+    int line;     // Line that defines it (label, EQU, literal pool), or -1
+    int set_at;   // Number of lines when the value was set, or -1
+};
+
+struct ResolveFrame {
+    int id;     // Symbol being resolved
+    int term;   // Next term of its expression to visit
+};
+
+// A forward reference waiting for its symbol to be defined
+struct Fixup {
+    int line;   // Line to re-encode once the symbol is known
+    int next;   // Next fixup for the same symbol, or -1
+};
+
+// Where pass 1 gets its statements when not straight from the lexer,
+// e.g. the macro expander of macro.h; next() returns 0 at end of input
+struct LineSource {
+    int (*next)(void *ctx, struct StrView *label, struct StrView *opcode,
+                struct StrView *operand);
+    void *ctx;
+};
+
+// Where the assembly stood between two statements of the source
+// Pass 1 fills in its own state and the sizes of every table; pass 2
+// adds where its output stood before line 'nlines'
+struct AsmCheckpoint {
+    long src_off;             // Source offset of the next statement
+    unsigned long long src_hash; // hash_bytes() of the source since the last checkpoint
+    int line_no;
+    int locctr, max_locctr, org_saved;
+    int nlines, text_len, nexprs, nterms, nsyms, nlits, lit_next;
+    long list_off;            // Listing offset of line 'nlines'
+    long obj_off;             // Object program offset of the open T-record
+    int nrecords;             // T-records written before it
+    int rec_addr, rec_len;    // Open T-record
+    unsigned char rec[TREC_MAX_BYTES];
+};
+
+// Counters for the --stats report (asmstats.h); SYMTAB counts its own
+// lookups and probes
+struct AsmStats {
+    long optab_lookups;    // Mnemonics looked up (pass 1, and macro.h with -M)
+    long bytes_read;       // Source bytes scanned
+    long trecords;         // T-records written
+    long obj_bytes;        // Bytes of the H-T-E object program
+};
+
+struct Assembly {
+    struct HashTab symtab; // Symbol -> address (valid once SymInfo.defined)
+
+    struct AsmLine *lines;
+    int nlines, lines_cap;
+    char *text;            // Source fields, kept for the listing
+    int text_len, text_cap;
+
+    struct AsmExpr *exprs;
+    int nexprs, exprs_cap;
+    struct ExprTerm *terms;
+    int nterms, terms_cap;
+    struct HashTab littab; // Literal name -> SYMTAB id, in order of first use
+    int lit_next;          // First LITTAB entry not yet placed in a pool
+    struct SymInfo *syms;  // Per SYMTAB id, grown on demand
+    int syms_cap;
+    struct ResolveFrame *stack;
+    int stack_cap;
+
+    char prog_name[8];
+    int start_addr;
+    int prog_length;
+    int error_flag;
+
+    // One-pass (load-and-go) state
+    int one_pass;
+    unsigned char *image;  // Object bytes, indexed by address - start_addr
+    int image_cap;
+    int *fixup_head;       // First pending fixup per SYMTAB id, or -1
+    int fixup_head_cap;
+    struct Fixup *fixups;
+    int nfixups, fixups_cap;
+
+    struct AsmStats stats;
+
+    struct LineSource *source; // NULL: read the lexer directly
+
+    // Incremental reassembly (asminc.h): checkpoints every ckpt_every
+    // lines (0 = none, only when reading the lexer) and, per line, the
+    // listing and object program offsets of its object code (-1 = none)
+    struct AsmCheckpoint *ckpts;
+    int nckpts, ckpts_cap;
+    int ckpt_every;
+    long *code_off;            // 2 per line: listing, object program
+
+    FILE *diag;            // Where errors go (NULL = stdout)
+    const char *diag_name; // Source name to prefix them with, or NULL
+};
+
+// Initialize an empty assembly
+static inline void asm_init(struct Assembly *as) {
+    memset(as, 0, sizeof(*as));
+    tab_init(&as->symtab, 1024);
+    tab_init(&as->littab, 64);
+    as->lines_cap = 256;
+    as->lines = malloc(as->lines_cap * sizeof(struct AsmLine));
+    as->text_cap = 4096;
+    as->text = malloc(as->text_cap);
+    strcpy(as->prog_name, "DEFAULT");
+}
+
+static inline void asm_free(struct Assembly *as) {
+    tab_free(&as->symtab);
+    tab_free(&as->littab);
+    free(as->lines);
+    free(as->text);
+    free(as->image);
+    free(as->fixup_head);
+    free(as->fixups);
+    free(as->exprs);
+    free(as->terms);
+    free(as->syms);
+    free(as->stack);
+    free(as->ckpts);
+    free(as->code_off);
+}
+
+// Report an error ("ERROR: ..." plus a newline) and flag the assembly
+static inline void asm_error(struct Assembly *as, const char *fmt, ...) {
+    FILE *fp = as->diag != NULL ? as->diag : stdout;
+    va_list ap;
+
+    if (as->diag_name != NULL)
+        fprintf(fp, "%s: ", as->diag_name);
+    fputs("ERROR: ", fp);
+    va_start(ap, fmt);
+    vfprintf(fp, fmt, ap);
+    va_end(ap);
+    fputc('\n', fp);
+    as->error_flag = 1;
+}
+
+// Get the label, opcode and operand text of a line
+static inline void asm_fields(const struct Assembly *as, const struct AsmLine *ln,
+                              const char **label, const char **opcode, const char **operand) {
+    *label = as->text + ln->text;
+    *opcode = *label + strlen(*label) + 1;
+    *operand = *opcode + strlen(*opcode) + 1;
+}
+
+// Append a field (plus a NUL) to the text pool; empty fields become "-"
+static inline void asm_push_text(struct Assembly *as, struct StrView v) {
+    if (v.len == 0 || view_eq(v, "~"))
+        v = view_of("-");
+    while (as->text_len + v.len + 1 > as->text_cap) {
+        as->text_cap *= 2;
+        as->text = realloc(as->text, as->text_cap);
+    }
+    memcpy(as->text + as->text_len, v.p, v.len);
+    as->text[as->text_len + v.len] = '\0';
+    as->text_len += v.len + 1;
+}
+
+// OPTAB entry of an instruction opcode id
+static inline const struct OpInfo *asm_opinfo(int op) {
+    return &optab_entries[op & (OP_EXTENDED - 1)];
+}
+
+// Instruction format (1-4) of an instruction opcode id
+static inline int asm_op_format(int op) {
+    return (op & OP_EXTENDED) ? 4 : asm_opinfo(op)->format;
+}
+
+// Map an opcode mnemonic to its opcode id
+static inline int asm_opcode_id(struct StrView opcode) {
+    int slot;
+
+    if (opcode.len > 1 && opcode.p[0] == '+') {
+        // Format 4 is only defined for format 3 instructions
+        slot = optab_lookup(opcode.p + 1, opcode.len - 1);
+        if (slot >= 0 && optab_entries[slot].format == 3)
+            return slot | OP_EXTENDED;
+        return OP_INVALID;
+    }
+    slot = optab_lookup(opcode.p, opcode.len);
+    if (slot >= 0)
+        return slot;
+    if (view_eq(opcode, "START")) return OP_START;
+    if (view_eq(opcode, "END")) return OP_END;
+    if (view_eq(opcode, "WORD")) return OP_WORD;
+    if (view_eq(opcode, "BYTE")) return OP_BYTE;
+    if (view_eq(opcode, "RESW")) return OP_RESW;
+    if (view_eq(opcode, "RESB")) return OP_RESB;
+    if (view_eq(opcode, "EQU")) return OP_EQU;
+    if (view_eq(opcode, "ORG")) return OP_ORG;
+    if (view_eq(opcode, "LTORG")) return OP_LTORG;
+    return OP_INVALID;
+}
+
+// Is this an instruction or directive? (for LineSources sorting fields)
+static inline int asm_is_opcode(struct StrView opcode) {
+    return asm_opcode_id(opcode) != OP_INVALID;
+}
+
+// Register number of a format 2 operand, or -1
+static inline int asm_register(struct StrView v) {
+    static const char *regs[] = { "A", "X", "L", "B", "S", "T", "F", "", "PC", "SW" };
+    for (int i = 0; i < 10; i++)
+        if (regs[i][0] != '\0' && view_eq(v, regs[i]))
+            return i;
+    return -1;
+}
+
+// Parse a format 2 operand ("r1", "r1,r2", "r1,n" or "n") into its
+// r1r2 byte; returns -1 if the operand is malformed
+static inline int asm_format2_operand(const struct OpInfo *info, struct StrView operand) {
+    struct StrView part[2] = { operand, { operand.p + operand.len, 0 } };
+    int r[2] = { 0, 0 }, nparts = 1;
+    int shift = info->opcode == 0xA4 || info->opcode == 0xA8; // SHIFTL/SHIFTR
+
+    for (int i = 0; i < operand.len; i++) {
+        if (operand.p[i] == ',') {
+            part[0].len = i;
+            part[1].p = operand.p + i + 1;
+            part[1].len = operand.len - i - 1;
+            nparts = 2;
+            break;
+        }
+    }
+    for (int i = 0; i < nparts; i++) {
+        if (part[i].len > 0 && part[i].p[0] >= '0' && part[i].p[0] <= '9') {
+            // SHIFTL/SHIFTR store the count minus one
+            r[i] = view_int(part[i], 10) - (shift && i == 1);
+            if (r[i] < 0 || r[i] > 15)
+                return -1;
+        } else if ((r[i] = asm_register(part[i])) < 0) {
+            return -1;
+        }
+    }
+    return r[0] << 4 | r[1];
+}
+
+// "-" and "~" stand for an empty label or operand column
+static inline int asm_is_empty(struct StrView v) {
+    return v.len == 0 || view_eq(v, "-") || view_eq(v, "~");
+}
+
+// Find a symbol, adding it as undefined on first reference
+static inline int asm_symbol_id(struct Assembly *as, struct StrView name) {
+    int id = tab_find(&as->symtab, name.p, name.len);
+    if (id < 0)
+        id = tab_add(&as->symtab, name.p, name.len, 0);
+    return id;
+}
+
+// Canonical name of a literal operand (=C'EOF', =X'05'): "=X'" and the
+// hex of its bytes, so equal constants share one entry however written
+// Returns the length of the name, or -1 if the literal is malformed
+static inline int asm_literal_name(struct StrView v, char *name, int size) {
+    static const char hexdig[] = "0123456789ABCDEF";
+    const char *body = v.p + 3;
+    int blen = v.len - 4, n = 3;
+
+    if (v.len < 5 || v.p[0] != '=' || v.p[2] != '\'' || v.p[v.len - 1] != '\'' ||
+        3 + 2 * blen + 2 > size)
+        return -1;
+    memcpy(name, "=X'", 3);
+    if (v.p[1] == 'C') {
+        for (int i = 0; i < blen; i++) {
+            unsigned char c = body[i];
+            name[n++] = hexdig[c >> 4];
+            name[n++] = hexdig[c & 15];
+        }
+    } else if (v.p[1] == 'X' && blen % 2 == 0) {
+        for (int i = 0; i < blen; i++) {
+            int c = body[i];
+            if (c >= 'a' && c <= 'f')
+                c -= 'a' - 'A';
+            if (!((c >= '0' && c <= '9') || (c >= 'A' && c <= 'F')))
+                return -1;
+            name[n++] = c;
+        }
+    } else {
+        return -1;
+    }
+    name[n++] = '\'';
+    name[n] = '\0';
+    return n;
+}
+
+// SYMTAB id of a literal, entering it in LITTAB on first use
+// Returns -1 if the literal is malformed
+static inline int asm_literal_id(struct Assembly *as, struct StrView v) {
+    char name[512];
+    int len = asm_literal_name(v, name, sizeof(name));
+    struct StrView key = { name, len };
+
+    if (len < 0)
+        return -1;
+    int id = asm_symbol_id(as, key);
+    if (tab_find(&as->littab, name, len) < 0)
+        tab_add(&as->littab, name, len, id);
+    return id;
+}
+
+// Symbol info of a SYMTAB id, growing the table as SYMTAB grows
+static inline struct SymInfo *asm_sym_info(struct Assembly *as, int id) {
+    if (id >= as->syms_cap) {
+        int cap = as->syms_cap ? as->syms_cap : 256;
+        while (cap <= id)
+            cap *= 2;
+        as->syms = realloc(as->syms, cap * sizeof(struct SymInfo));
+        for (int i = as->syms_cap; i < cap; i++) {
+            as->syms[i].expr = -1;
+            as->syms[i].state = SYM_PLAIN;
+            as->syms[i].rel = 1;
+            as->syms[i].defined = 0;
+            as->syms[i].line = -1;
+            as->syms[i].set_at = -1;
+        }
+        as->syms_cap = cap;
+    }
+    return &as->syms[id];
+}
+
+// Does a symbol have a value in SYMTAB yet?
+static inline int asm_sym_has_value(const struct Assembly *as, int id) {
+    return id < as->syms_cap && as->syms[id].defined;
+}
+
+// Has a symbol been given a value (or an EQU expression)?
+static inline int asm_symbol_defined(const struct Assembly *as, int id) {
+    return asm_sym_has_value(as, id) || (id < as->syms_cap && as->syms[id].state != SYM_PLAIN);
+}
+
+// Optionally signed decimal number
+static inline int asm_is_number(struct StrView v) {
+    int i = v.len > 0 && (v.p[0] == '+' || v.p[0] == '-');
+    if (i == v.len)
+        return 0;
+    for (; i < v.len; i++)
+        if (v.p[i] < '0' || v.p[i] > '9')
+            return 0;
+    return 1;
+}
+
+// Is an operand more than a bare symbol name?
+static inline int asm_is_expr(struct StrView v) {
+    if (v.len == 0)
+        return 0;
+    if (v.p[0] == '*' || v.p[0] == '+' || v.p[0] == '-' || (v.p[0] >= '0' && v.p[0] <= '9'))
+        return 1;
+    for (int i = 1; i < v.len; i++)
+        if (v.p[i] == '+' || v.p[i] == '-')
+            return 1;
+    return 0;
+}
+
+// Parse "term {+|- term}" into the expression pool; a term is a decimal
+// number, a symbol or '*' (the address of the line)
+// Returns the expression id, or -1 on a syntax error
+static inline int asm_parse_expr(struct Assembly *as, struct StrView v, int locctr) {
+    int first = as->nterms, sign = 1, i = 0;
+
+    if (v.len > 0 && (v.p[0] == '+' || v.p[0] == '-')) {
+        sign = v.p[0] == '-' ? -1 : 1;
+        i = 1;
+    }
+    for (;;) {
+        struct StrView t = { v.p + i, 0 };
+        while (i < v.len && v.p[i] != '+' && v.p[i] != '-')
+            i++;
+        t.len = v.p + i - t.p;
+        if (t.len == 0) {
+            as->nterms = first;
+            return -1;
+        }
+
+        if (as->nterms == as->terms_cap) {
+            as->terms_cap = as->terms_cap ? as->terms_cap * 2 : 256;
+            as->terms = realloc(as->terms, as->terms_cap * sizeof(struct ExprTerm));
+        }
+        struct ExprTerm *term = &as->terms[as->nterms++];
+        term->sign = sign;
+        term->sym = -1;
+        term->value = 0;
+        term->rel = 0;
+        if (view_eq(t, "*")) {
+            term->value = locctr;
+            term->rel = 1;
+        } else if (asm_is_number(t)) {
+            term->value = view_int(t, 10);
+        } else {
+            term->sym = asm_symbol_id(as, t);
+        }
+
+        if (i == v.len)
+            break;
+        sign = v.p[i++] == '-' ? -1 : 1;
+    }
+
+    if (as->nexprs == as->exprs_cap) {
+        as->exprs_cap = as->exprs_cap ? as->exprs_cap * 2 : 64;
+        as->exprs = realloc(as->exprs, as->exprs_cap * sizeof(struct AsmExpr));
+    }
+    as->exprs[as->nexprs].first = first;
+    as->exprs[as->nexprs].n = as->nterms - first;
+    return as->nexprs++;
+}
+
+// Value of an expression from the current SYMTAB into *value; *rel
+// receives the number of relocatable terms (1 for an address, 0 for an
+// absolute value)
+// Returns 1, or 0 if a term has no value yet
+static inline int asm_expr_value(const struct Assembly *as, int e, int *value, int *rel) {
+    const struct ExprTerm *t = &as->terms[as->exprs[e].first];
+
+    *value = *rel = 0;
+    for (int i = 0; i < as->exprs[e].n; i++, t++) {
+        if (t->sym < 0) {
+            *value += t->sign * t->value;
+            *rel += t->sign * t->rel;
+            continue;
+        }
+        if (!asm_sym_has_value(as, t->sym))
+            return 0;
+        *value += t->sign * as->symtab.entries[t->sym].value;
+        *rel += t->sign * as->syms[t->sym].rel;
+    }
+    return 1;
+}
+
+// Append a line record; the label is not defined here
+static inline struct AsmLine *asm_add_line(struct Assembly *as, int locctr, struct StrView label,
+                                           struct StrView opcode, struct StrView operand) {
+    int bad_expr = 0;
+
+    if (as->nlines == as->lines_cap) {
+        as->lines_cap *= 2;
+        as->lines = realloc(as->lines, as->lines_cap * sizeof(struct AsmLine));
+    }
+    struct AsmLine *ln = &as->lines[as->nlines++];
+    ln->locctr = locctr;
+    ln->op = asm_opcode_id(opcode);
+    as->stats.optab_lookups++;
+    ln->label = -1;
+    ln->sym = -1;
+    ln->value = 0;
+    ln->mode = ADDR_SIMPLE;
+    ln->expr = -1;
+    ln->text = as->text_len;
+    asm_push_text(as, label);
+    asm_push_text(as, opcode);
+    asm_push_text(as, operand);
+
+    if (ln->op >= 0 && asm_op_format(ln->op) == 2) {
+        ln->value = asm_format2_operand(asm_opinfo(ln->op), operand);
+        if (ln->value < 0) {
+            asm_error(as, "Bad register operand '%.*s' at %X", operand.len, operand.p, locctr);
+            ln->value = 0;
+        }
+    } else if (ln->op >= 0 && asm_op_format(ln->op) >= 3 && !asm_is_empty(operand)) {
+        if (operand.p[0] == '#' || operand.p[0] == '@') {
+            ln->mode = operand.p[0] == '#' ? ADDR_IMMEDIATE : ADDR_INDIRECT;
+            operand.p++;
+            operand.len--;
+        }
+        if (operand.len > 0 && operand.p[0] == '=') {
+            if (ln->mode != ADDR_SIMPLE || (ln->sym = asm_literal_id(as, operand)) < 0) {
+                asm_error(as, "Bad literal '%.*s' at %X", operand.len, operand.p, locctr);
+                ln->sym = -1;
+            }
+        } else if (!asm_is_expr(operand))
+            ln->sym = asm_symbol_id(as, operand);
+        else if (asm_is_number(operand))
+            ln->value = view_int(operand, 10);
+        else if ((ln->expr = asm_parse_expr(as, operand, locctr)) < 0)
+            bad_expr = 1;
+    } else if (ln->op == OP_WORD && !asm_is_number(operand)) {
+        if ((ln->expr = asm_parse_expr(as, operand, locctr)) < 0)
+            bad_expr = 1;
+    } else if (ln->op == OP_WORD || ln->op == OP_RESW || ln->op == OP_RESB) {
+        ln->value = view_int(operand, 10);
+    } else if (ln->op == OP_EQU || (ln->op == OP_ORG && !asm_is_empty(operand))) {
+        if ((ln->expr = asm_parse_expr(as, operand, locctr)) < 0)
+            bad_expr = 1;
+    }
+    if (bad_expr) {
+        asm_error(as, "Bad expression '%.*s' at %X", operand.len, operand.p, locctr);
+    }
+    return ln;
+}
+
+// Number of bytes a line occupies
+static inline int asm_line_size(const struct Assembly *as, const struct AsmLine *ln) {
+    const char *label, *opcode, *operand;
+
+    switch (ln->op) {
+    case OP_WORD: return 3;
+    case OP_RESW: return 3 * ln->value;
+    case OP_RESB: return ln->value;
+    case OP_BYTE:
+        asm_fields(as, ln, &label, &opcode, &operand);
+        // C'EOF' -> 3 bytes, X'F1' -> 1 byte
+        if (operand[0] == 'C')
+            return strlen(operand) - 3;
+        if (operand[0] == 'X')
+            return (strlen(operand) - 3) / 2;
+        return 0;
+    case OP_START:
+    case OP_END:
+    case OP_EQU:
+    case OP_ORG:
+    case OP_LTORG:
+    case OP_INVALID:
+        return 0;
+    default:
+        return asm_op_format(ln->op);
+    }
+}
+
+// Read the next statement and sort its fields into label/opcode/operand
+// An indented line has no label; otherwise a 2-field line is
+// "opcode operand" if its first field is an opcode or directive,
+// "label opcode" if not
+// At end of input an implicit END line is returned; with a LineSource
+// the source does the sorting itself
+static inline void asm_next_line(struct Assembly *as, struct Lexer *lx, struct StrView *label,
+                                 struct StrView *opcode, struct StrView *operand) {
+    struct StrView f[3], none = { "-", 1 };
+    int n;
+
+    if (as->source != NULL) {
+        if (!as->source->next(as->source->ctx, label, opcode, operand)) {
+            *label = *operand = none;
+            *opcode = view_of("END");
+        }
+        return;
+    }
+    n = lex_next(lx, f);
+    *label = *operand = none;
+    if (n == 0) {
+        *opcode = view_of("END");
+    } else if (n == 1) {
+        *opcode = f[0];
+    } else if (lx->indented) {
+        *opcode = f[0];
+        *operand = f[1]; // A third field is a comment
+    } else if (n == 2) {
+        as->stats.optab_lookups++;
+        if (asm_opcode_id(f[0]) != OP_INVALID) {
+            *opcode = f[0];
+            *operand = f[1];
+        } else {
+            *label = f[0];
+            *opcode = f[1];
+        }
+    } else {
+        *label = f[0];
+        *opcode = f[1];
+        *operand = f[2];
+    }
+}
+
+// Operand value of an instruction or WORD line into *value
+// Returns 1, or 0 if a symbol it uses has no value
+static inline int asm_operand_value(const struct Assembly *as, const struct AsmLine *ln,
+                                    int *value) {
+    int rel;
+
+    if (ln->expr >= 0)
+        return asm_expr_value(as, ln->expr, value, &rel);
+    if (ln->sym >= 0) {
+        *value = as->symtab.entries[ln->sym].value;
+        return asm_sym_has_value(as, ln->sym);
+    }
+    *value = ln->value;
+    return 1;
+}
+
+// Does the operand of a line hold a relocatable address?
+static inline int asm_operand_rel(const struct Assembly *as, const struct AsmLine *ln) {
+    int rel = 0, value;
+
+    if (ln->expr >= 0)
+        asm_expr_value(as, ln->expr, &value, &rel);
+    else if (ln->sym >= 0)
+        rel = ln->sym < as->syms_cap ? as->syms[ln->sym].rel : 1;
+    return rel == 1;
+}
+
+// Object code of one line as bytes; returns the number of bytes
+// Only reads the line records and SYMTAB, so lines can be encoded
+// concurrently; undefined symbols are encoded as address 0
+static inline int asm_encode_bytes(const struct Assembly *as, const struct AsmLine *ln,
+                                   unsigned char *p) {
+    const char *label, *opcode, *operand;
+    int size = asm_line_size(as, ln);
+
+    if (ln->op >= 0) {
+        int code = asm_opinfo(ln->op)->opcode;
+        int addr;
+        if (!asm_operand_value(as, ln, &addr))
+            addr = 0;
+
+        switch (asm_op_format(ln->op)) {
+        case 1:
+            p[0] = code;
+            break;
+        case 2:
+            p[0] = code;
+            p[1] = ln->value;
+            break;
+        case 3:
+            if (ln->mode == ADDR_SIMPLE) {
+                // SIC-compatible: n=i=0 and a 16-bit address
+                p[0] = code;
+                p[1] = (addr >> 8) & 0xFF;
+            } else {
+                // n/i from the prefix, xbpe=0 and a 12-bit address
+                p[0] = code | (ln->mode == ADDR_IMMEDIATE ? 1 : 2);
+                p[1] = (addr >> 8) & 0x0F;
+            }
+            p[2] = addr & 0xFF;
+            break;
+        case 4:
+            p[0] = code | (ln->mode == ADDR_IMMEDIATE ? 1 : ln->mode == ADDR_INDIRECT ? 2 : 3);
+            p[1] = 0x10 | ((addr >> 16) & 0x0F); // e=1
+            p[2] = (addr >> 8) & 0xFF;
+            p[3] = addr & 0xFF;
+            break;
+        }
+        return size;
+    }
+
+    if (ln->op == OP_WORD) {
+        int value;
+        if (!asm_operand_value(as, ln, &value))
+            value = 0;
+        p[0] = (value >> 16) & 0xFF;
+        p[1] = (value >> 8) & 0xFF;
+        p[2] = value & 0xFF;
+        return 3;
+    }
+    if (ln->op == OP_BYTE) {
+        asm_fields(as, ln, &label, &opcode, &operand);
+        if (operand[0] == 'C') {
+            memcpy(p, operand + 2, size);
+        } else {
+            for (int i = 0; i < size; i++) {
+                char hex[3] = { operand[2 + 2 * i], operand[3 + 2 * i], '\0' };
+                p[i] = (unsigned char)strtol(hex, NULL, 16);
+            }
+        }
+        return size;
+    }
+    return 0;
+}
+
+// Report the symbols a line uses that never got a value
+static inline void asm_check_undefined(struct Assembly *as, const struct AsmLine *ln) {
+    if (ln->expr >= 0) {
+        const struct ExprTerm *t = &as->terms[as->exprs[ln->expr].first];
+        for (int i = 0; i < as->exprs[ln->expr].n; i++, t++) {
+            if (t->sym >= 0 && !asm_sym_has_value(as, t->sym)) {
+                asm_error(as, "Undefined symbol '%s'", as->symtab.entries[t->sym].name);
+            }
+        }
+    } else if (ln->sym >= 0 && !asm_sym_has_value(as, ln->sym)) {
+        asm_error(as, "Undefined symbol '%s'", as->symtab.entries[ln->sym].name);
+    }
+}
+
+// Report a #/@ format 3 operand that does not fit its 12-bit field
+// Returns 1 if the line is in error
+static inline int asm_check_range(struct Assembly *as, const struct AsmLine *ln) {
+    int addr;
+
+    if (ln->op < 0 || asm_op_format(ln->op) != 3 || ln->mode == ADDR_SIMPLE)
+        return 0;
+    if (!asm_operand_value(as, ln, &addr) || (addr >= 0 && addr <= 0xFFF))
+        return 0;
+    asm_error(as, "Operand %X out of range at %X (use +format 4)", addr, ln->locctr);
+    return 1;
+}
+
+// Pending fixup chain of a symbol, growing the table as SYMTAB grows
+static inline int *asm_fixup_head(struct Assembly *as, int id) {
+    if (id >= as->fixup_head_cap) {
+        int cap = as->fixup_head_cap ? as->fixup_head_cap : 256;
+        while (cap <= id)
+            cap *= 2;
+        as->fixup_head = realloc(as->fixup_head, cap * sizeof(int));
+        for (int i = as->fixup_head_cap; i < cap; i++)
+            as->fixup_head[i] = -1;
+        as->fixup_head_cap = cap;
+    }
+    return &as->fixup_head[id];
+}
+
+// Make sure the image covers offsets [0, end)
+static inline void asm_image_reserve(struct Assembly *as, int end) {
+    if (end <= as->image_cap)
+        return;
+    int cap = as->image_cap ? as->image_cap : 4096;
+    while (cap < end)
+        cap *= 2;
+    as->image = realloc(as->image, cap);
+    memset(as->image + as->image_cap, 0, cap - as->image_cap);
+    as->image_cap = cap;
+}
+
+// Give a label its address and, in one-pass mode, re-encode every
+// forward reference chained on it
+static inline void asm_define_symbol(struct Assembly *as, int id, int addr) {
+    struct SymInfo *si = asm_sym_info(as, id);
+
+    as->symtab.entries[id].value = addr;
+    si->defined = 1;
+    si->set_at = as->nlines;
+    if (si->line < 0)
+        si->line = as->nlines - 1; // EQU symbols already have their line
+    if (!as->one_pass || id >= as->fixup_head_cap)
+        return;
+
+    for (int f = as->fixup_head[id]; f >= 0; f = as->fixups[f].next) {
+        const struct AsmLine *ln = &as->lines[as->fixups[f].line];
+        asm_encode_bytes(as, ln, as->image + (ln->locctr - as->start_addr));
+    }
+    as->fixup_head[id] = -1;
+}
+
+// Resolve a symbol defined by EQU: the symbols its expression uses are
+// resolved first, depth first on an explicit stack, so long EQU chains
+// cannot overflow the C stack and each symbol is evaluated only once
+static inline void asm_resolve_symbol(struct Assembly *as, int id) {
+    int sp = 0, cycle = 0;
+
+    if (id >= as->syms_cap || as->syms[id].state != SYM_PENDING)
+        return;
+    as->syms[id].state = SYM_ACTIVE;
+    if (as->stack_cap == 0) {
+        as->stack_cap = 64;
+        as->stack = malloc(as->stack_cap * sizeof(struct ResolveFrame));
+    }
+    as->stack[sp].id = id;
+    as->stack[sp++].term = 0;
+
+    while (sp > 0) {
+        struct ResolveFrame *f = &as->stack[sp - 1];
+        struct SymInfo *si = &as->syms[f->id];
+        const struct AsmExpr *e = &as->exprs[si->expr];
+
+        if (f->term < e->n) {
+            int t = as->terms[e->first + f->term++].sym;
+            if (t < 0 || t >= as->syms_cap)
+                continue;
+            if (as->syms[t].state == SYM_ACTIVE) {
+                asm_error(as, "Circular definition of '%s'", as->symtab.entries[t].name);
+                cycle = 1;
+            } else if (as->syms[t].state == SYM_PENDING) {
+                if (sp == as->stack_cap) {
+                    as->stack_cap *= 2;
+                    as->stack = realloc(as->stack, as->stack_cap * sizeof(struct ResolveFrame));
+                }
+                as->syms[t].state = SYM_ACTIVE;
+                as->stack[sp].id = t;
+                as->stack[sp++].term = 0;
+            }
+            continue;
+        }
+
+        // Every term is resolved (or known to be undefined)
+        int rel, value, known = asm_expr_value(as, si->expr, &value, &rel);
+        si->state = SYM_PLAIN;
+        si->rel = rel;
+        if (known) {
+            asm_define_symbol(as, f->id, value);
+        } else if (!cycle) {
+            asm_error(as, "Undefined symbol in EQU '%s'", as->symtab.entries[f->id].name);
+        }
+        sp--;
+    }
+}
+
+// Evaluate an expression in pass 1, resolving the EQU symbols it uses
+// Returns 1, or 0 if it has no value (see asm_expr_value())
+static inline int asm_expr_resolve(struct Assembly *as, int e, int *value, int *rel) {
+    const struct ExprTerm *t = &as->terms[as->exprs[e].first];
+    for (int i = 0; i < as->exprs[e].n; i++)
+        if (t[i].sym >= 0)
+            asm_resolve_symbol(as, t[i].sym);
+    return asm_expr_value(as, e, value, rel);
+}
+
+// One-pass mode: re-encode 'line' once symbol 'id' is defined
+static inline void asm_chain_fixup(struct Assembly *as, int id, int line) {
+    int *head = asm_fixup_head(as, id);
+
+    if (as->nfixups == as->fixups_cap) {
+        as->fixups_cap = as->fixups_cap ? as->fixups_cap * 2 : 256;
+        as->fixups = realloc(as->fixups, as->fixups_cap * sizeof(struct Fixup));
+    }
+    as->fixups[as->nfixups].line = line;
+    as->fixups[as->nfixups].next = *head;
+    *head = as->nfixups++;
+}
+
+// One-pass mode: emit a line's object code into the image
+static inline void asm_emit_line(struct Assembly *as, int line) {
+    const struct AsmLine *ln = &as->lines[line];
+    int off = ln->locctr - as->start_addr;
+    int size = asm_line_size(as, ln);
+
+    if (size <= 0 || off < 0)
+        return;
+    asm_image_reserve(as, off + size);
+
+    // Forward references: chain the line on every symbol it still
+    // needs, it is encoded again as each one is defined
+    if (ln->op >= 0 || ln->op == OP_WORD) {
+        if (ln->expr >= 0) {
+            const struct ExprTerm *t = &as->terms[as->exprs[ln->expr].first];
+            for (int i = 0; i < as->exprs[ln->expr].n; i++, t++)
+                if (t->sym >= 0 && !asm_sym_has_value(as, t->sym))
+                    asm_chain_fixup(as, t->sym, line);
+        } else if (ln->sym >= 0 && !asm_sym_has_value(as, ln->sym)) {
+            asm_chain_fixup(as, ln->sym, line);
+        }
+    }
+    asm_encode_bytes(as, ln, as->image + off);
+}
+
+// Place the literals used since the last pool at 'locctr' (LTORG, END)
+// Returns the LOCCTR after the pool
+static inline int asm_place_literals(struct Assembly *as, int locctr) {
+    for (; as->lit_next < as->littab.count; as->lit_next++) {
+        const struct TabEntry *e = &as->littab.entries[as->lit_next];
+        struct StrView name = { e->name, e->len }, operand = { e->name + 1, e->len - 1 };
+        int id = e->value;
+
+        struct AsmLine *ln = asm_add_line(as, locctr, name, view_of("BYTE"), operand);
+        ln->label = id;
+        asm_define_symbol(as, id, locctr);
+        if (as->one_pass)
+            asm_emit_line(as, as->nlines - 1);
+        locctr += asm_line_size(as, ln);
+    }
+    return locctr;
+}
+
+// Save a checkpoint if ckpt_every lines were added since the last one
+// Called between statements, before the next one is read
+static inline void asm_checkpoint(struct Assembly *as, const struct Lexer *lx, int locctr,
+                                  int max_locctr, int org_saved) {
+    const struct AsmCheckpoint *last = as->nckpts ? &as->ckpts[as->nckpts - 1] : NULL;
+    long from = last ? last->src_off : 0;
+
+    if (as->nlines - (last ? last->nlines : 0) < as->ckpt_every)
+        return;
+    if (as->nckpts == as->ckpts_cap) {
+        as->ckpts_cap = as->ckpts_cap ? as->ckpts_cap * 2 : 64;
+        as->ckpts = realloc(as->ckpts, as->ckpts_cap * sizeof(struct AsmCheckpoint));
+    }
+    struct AsmCheckpoint *c = &as->ckpts[as->nckpts++];
+    memset(c, 0, sizeof(*c));
+    c->src_off = lx->cur - lx->buf;
+    c->src_hash = hash_bytes(lx->buf + from, c->src_off - from);
+    c->line_no = lx->line_no;
+    c->locctr = locctr;
+    c->max_locctr = max_locctr;
+    c->org_saved = org_saved;
+    c->nlines = as->nlines;
+    c->text_len = as->text_len;
+    c->nexprs = as->nexprs;
+    c->nterms = as->nterms;
+    c->nsyms = as->symtab.count;
+    c->nlits = as->littab.count;
+    c->lit_next = as->lit_next;
+}
+
+// Pass 1 from the state in 'at' (LOCCTR and ORG) up to END
+// 'first' is a statement already read (label, opcode, operand), or
+// NULL to start with the next one from the source
+// Returns 1 if errors were found, 0 otherwise
+static inline int asm_pass1_run(struct Assembly *as, struct Lexer *lx,
+                                const struct AsmCheckpoint *at, const struct StrView *first) {
+    struct StrView label, opcode, operand;
+    int locctr = at->locctr, max_locctr = at->max_locctr, org_saved = at->org_saved;
+
+    if (first != NULL) {
+        label = first[0];
+        opcode = first[1];
+        operand = first[2];
+    } else {
+        asm_next_line(as, lx, &label, &opcode, &operand);
+    }
+
+    // Main Processing Loop (while opcode is not END)
+    while (!view_eq(opcode, "END")) {
+        struct AsmLine *ln = asm_add_line(as, locctr, label, opcode, operand);
+
+        // Handle Label
+        if (!asm_is_empty(label)) {
+            int id = asm_symbol_id(as, label);
+            if (asm_symbol_defined(as, id)) {
+                asm_error(as, "Duplicate symbol '%.*s' at %X (line %d)",
+                          label.len, label.p, locctr, lx->line_no);
+            } else if (ln->op == OP_EQU) {
+                // Evaluated on first use, see asm_resolve_symbol()
+                ln->label = id;
+                if (ln->expr >= 0) {
+                    struct SymInfo *si = asm_sym_info(as, id);
+                    si->expr = ln->expr;
+                    si->state = SYM_PENDING;
+                    si->line = as->nlines - 1;
+                }
+            } else {
+                asm_define_symbol(as, id, locctr);
+                ln->label = id;
+            }
+        } else if (ln->op == OP_EQU) {
+            asm_error(as, "EQU without a label at %X (line %d)", locctr, lx->line_no);
+        }
+
+        if (ln->op == OP_INVALID || ln->op == OP_START) {
+            asm_error(as, "Invalid opcode '%.*s' at %X (line %d)",
+                      opcode.len, opcode.p, locctr, lx->line_no);
+        }
+        if (as->one_pass)
+            asm_emit_line(as, as->nlines - 1);
+        locctr += asm_line_size(as, ln);
+
+        if (ln->op == OP_LTORG) {
+            locctr = asm_place_literals(as, locctr);
+        } else if (ln->op == OP_ORG && ln->expr >= 0) {
+            // The new LOCCTR must be known now, so no forward references
+            int rel, value;
+            if (!asm_expr_resolve(as, ln->expr, &value, &rel)) {
+                asm_error(as, "ORG operand must be defined earlier (line %d)", lx->line_no);
+            } else {
+                org_saved = locctr;
+                locctr = value;
+            }
+        } else if (ln->op == OP_ORG && org_saved >= 0) {
+            locctr = org_saved;
+            org_saved = -1;
+        }
+        if (locctr > max_locctr)
+            max_locctr = locctr;
+
+        if (as->ckpt_every > 0 && as->source == NULL)
+            asm_checkpoint(as, lx, locctr, max_locctr, org_saved);
+        asm_next_line(as, lx, &label, &opcode, &operand);
+    }
+
+    // Handle END directive, after the last literal pool
+    locctr = asm_place_literals(as, locctr);
+    if (locctr > max_locctr)
+        max_locctr = locctr;
+    asm_add_line(as, locctr, label, opcode, operand);
+    as->prog_length = max_locctr - as->start_addr;
+
+    // Resolve the EQU symbols nothing has needed yet
+    for (int id = 0; id < as->syms_cap && id < as->symtab.count; id++)
+        asm_resolve_symbol(as, id);
+    return as->error_flag;
+}
+
+// Pass 1: read the source and build the line records and SYMTAB
+// Returns 1 if errors were found, 0 otherwise
+static inline int asm_pass1(struct Assembly *as, struct Lexer *lx) {
+    struct StrView f[3];
+    struct AsmCheckpoint at;
+
+    as->stats.bytes_read += lx->end - lx->buf;
+
+    // Read First Line and Handle START
+    asm_next_line(as, lx, &f[0], &f[1], &f[2]);
+
+    memset(&at, 0, sizeof(at));
+    at.org_saved = -1;
+    if (view_eq(f[1], "START")) {
+        as->start_addr = view_int(f[2], 16);
+        snprintf(as->prog_name, sizeof(as->prog_name), "%.*s",
+                 f[0].len < 6 ? f[0].len : 6, f[0].p);
+        at.locctr = at.max_locctr = as->start_addr;
+        asm_add_line(as, at.locctr, f[0], f[1], f[2]);
+        return asm_pass1_run(as, lx, &at, NULL);
+    }
+    as->start_addr = 0;
+    return asm_pass1_run(as, lx, &at, f);
+}
+
+// Write the pass 1 results in the classic text formats
+static inline void asm_write_intermediate(const struct Assembly *as, FILE *f_inter,
+                                          FILE *f_symtab, FILE *f_length) {
+    const char *label, *opcode, *operand;
+
+    for (int i = 0; i < as->nlines; i++) {
+        const struct AsmLine *ln = &as->lines[i];
+        asm_fields(as, ln, &label, &opcode, &operand);
+        fprintf(f_inter, "%X\t%s\t%s\t%s\n", ln->locctr, label, opcode, operand);
+        if (ln->label >= 0)
+            fprintf(f_symtab, "%s\t%X\n", label, as->symtab.entries[ln->label].value);
+    }
+    fprintf(f_length, "%X\n", as->prog_length);
+}
+
+// Rebuild the line records from intermediate.txt, symtab.txt and length.txt
+// Returns 0 on success, -1 if a file cannot be read
+static inline int asm_read_intermediate(struct Assembly *as, const char *inter_file,
+                                        const char *symtab_file, const char *length_file) {
+    char locctr_str[20], label[64], opcode[64], operand[64];
+    FILE *f_length = fopen(length_file, "r");
+    FILE *f_inter = fopen(inter_file, "r");
+
+    if (f_length == NULL || f_inter == NULL ||
+        tab_load(&as->symtab, symtab_file, 16) < 0) {
+        if (f_length) fclose(f_length);
+        if (f_inter) fclose(f_inter);
+        return -1;
+    }
+
+    for (int id = 0; id < as->symtab.count; id++)
+        asm_sym_info(as, id)->defined = 1;
+
+    if (fscanf(f_length, "%X", &as->prog_length) != 1)
+        as->prog_length = 0;
+    fclose(f_length);
+
+    while (fscanf(f_inter, "%19s %63s %63s %63s", locctr_str, label, opcode, operand) == 4) {
+        struct AsmLine *ln = asm_add_line(as, (int)strtol(locctr_str, NULL, 16),
+                                          view_of(label), view_of(opcode), view_of(operand));
+        if (ln->op == OP_START && as->nlines == 1) {
+            as->start_addr = (int)strtol(operand, NULL, 16);
+            snprintf(as->prog_name, sizeof(as->prog_name), "%.6s", label);
+        }
+        if (ln->op == OP_END)
+            break;
+    }
+    fclose(f_inter);
+    return 0;
+}
+
+// Number of hex characters of object code a line produces
+static inline int asm_hex_len(const struct Assembly *as, const struct AsmLine *ln) {
+    if (ln->op >= 0 || ln->op == OP_WORD || ln->op == OP_BYTE)
+        return 2 * asm_line_size(as, ln);
+    return 0;
+}
+
+// Object code of one line as hex text ("" for lines that emit none)
+// The bytes are encoded at the start of the buffer and expanded to hex
+// in place, back to front
+static inline void asm_encode(const struct Assembly *as, const struct AsmLine *ln, char *object_code) {
+    static const char hexdig[] = "0123456789ABCDEF";
+    unsigned char *p = (unsigned char *)object_code;
+    int n = asm_encode_bytes(as, ln, p);
+
+    object_code[2 * n] = '\0';
+    for (int i = n - 1; i >= 0; i--) {
+        unsigned char b = p[i];
+        object_code[2 * i] = hexdig[b >> 4];
+        object_code[2 * i + 1] = hexdig[b & 15];
+    }
+}
+
+// A range of lines encoded by one pass 2 worker
+struct Pass2Chunk {
+    const struct Assembly *as;
+    char *hex;          // Object code of every line, NUL-separated
+    const long *hex_off;
+    int first, last;
+};
+
+static inline void *asm_encode_chunk(void *arg) {
+    struct Pass2Chunk *c = arg;
+    const struct Assembly *as = c->as;
+
+    for (int i = c->first; i < c->last; i++)
+        asm_encode(as, &as->lines[i], c->hex + c->hex_off[i]);
+    return NULL;
+}
+
+// Convert hex text to bytes; returns the number of bytes
+static inline int asm_hex_to_bytes(const char *hex, unsigned char *out) {
+    int n = 0;
+    for (; hex[0] && hex[1]; hex += 2) {
+        int hi = hex[0] <= '9' ? hex[0] - '0' : (hex[0] & 0xDF) - 'A' + 10;
+        int lo = hex[1] <= '9' ? hex[1] - '0' : (hex[1] & 0xDF) - 'A' + 10;
+        out[n++] = (hi << 4) | lo;
+    }
+    return n;
+}
+
+// Number of pass 2 workers for 'nlines' lines: not a thread per few
+// lines, and at least one (the lower bound comes last, so chunk 0
+// always exists)
+static inline int asm_pass2_workers(int nlines, int nthreads) {
+    if (nthreads > nlines / 1024 + 1)
+        nthreads = nlines / 1024 + 1;
+    return nthreads < 1 ? 1 : nthreads;
+}
+
+// Record where pass 2 output stands at a checkpoint line
+static inline void asm_checkpoint_output(struct AsmCheckpoint *c, long list_off,
+                                         const struct TRecWriter *trec) {
+    c->list_off = list_off;
+    c->obj_off = trec_pos(trec);
+    c->nrecords = trec->nrecords;
+    c->rec_addr = trec->rec_addr;
+    c->rec_len = trec->rec_len;
+    memcpy(c->rec, trec->rec, trec->rec_len);
+}
+
+// Pass 2 from checkpoint 'from' (NULL = the whole program)
+// When resuming, f_list and f_obj must already be positioned at the
+// checkpoint's offsets; the H record and the lines before it are left
+// as they are. With ckpt_every set, the checkpoints reached and the
+// offsets of every line's object code are recorded as well
+static inline void asm_pass2_from(struct Assembly *as, struct AsmCheckpoint *from, FILE *f_list,
+                                  FILE *f_obj, FILE *f_bin, int nthreads) {
+    const char *label, *opcode, *operand;
+    struct SicObjWriter bin;
+    struct TRecWriter trec;
+    long *hex_off = malloc((as->nlines + 1) * sizeof(long));
+    int first = from ? from->nlines : 0, max_len = 0, ck = 0;
+    long list_pos = from ? from->list_off : 0;
+
+    if (as->ckpt_every > 0)
+        as->code_off = realloc(as->code_off, 2 * (as->nlines + 1) * sizeof(long));
+
+    // Give every line a slot for its object code
+    hex_off[first] = 0;
+    for (int i = first; i < as->nlines; i++) {
+        int len = asm_hex_len(as, &as->lines[i]);
+        if (len > max_len)
+            max_len = len;
+        hex_off[i + 1] = hex_off[i] + len + 1;
+    }
+    char *hex = malloc(hex_off[as->nlines] + 1);
+    unsigned char *bytes = malloc(max_len / 2 + 1);
+
+    // Encode all lines
+    int count = as->nlines - first;
+    nthreads = asm_pass2_workers(count, nthreads);
+    struct Pass2Chunk *chunks = malloc(nthreads * sizeof(struct Pass2Chunk));
+    pthread_t *tids = malloc(nthreads * sizeof(pthread_t));
+    int *started = calloc(nthreads, sizeof(int));
+    int per = (count + nthreads - 1) / nthreads;
+
+    for (int t = 0; t < nthreads; t++) {
+        chunks[t].as = as;
+        chunks[t].hex = hex;
+        chunks[t].hex_off = hex_off;
+        chunks[t].first = first + (t * per < count ? t * per : count);
+        chunks[t].last = first + ((t + 1) * per < count ? (t + 1) * per : count);
+    }
+    for (int t = 1; t < nthreads; t++) {
+        started[t] = pthread_create(&tids[t], NULL, asm_encode_chunk, &chunks[t]) == 0;
+        if (!started[t])
+            asm_encode_chunk(&chunks[t]); // Fall back to this thread
+    }
+    asm_encode_chunk(&chunks[0]);
+    for (int t = 1; t < nthreads; t++) {
+        if (started[t])
+            pthread_join(tids[t], NULL);
+    }
+
+    // Write Header (H) Record, or pick up where the checkpoint left off
+    if (from != NULL)
+        trec_resume(&trec, f_obj, from->obj_off, from->nrecords, from->rec_addr, from->rec,
+                    from->rec_len);
+    else
+        trec_begin(&trec, f_obj, as->prog_name, as->start_addr, as->prog_length);
+    if (f_bin != NULL)
+        sicobj_begin(&bin, as->prog_name, as->start_addr, as->prog_length);
+    while (ck < as->nckpts && as->ckpts[ck].nlines < first)
+        ck++;
+
+    // Merge: listing and T-records in line order
+    for (int i = first; i < as->nlines; i++) {
+        const struct AsmLine *ln = &as->lines[i];
+        const char *object_code = hex + hex_off[i];
+        asm_fields(as, ln, &label, &opcode, &operand);
+
+        if (ck < as->nckpts && as->ckpts[ck].nlines == i)
+            asm_checkpoint_output(&as->ckpts[ck++], list_pos, &trec);
+        if (as->code_off != NULL)
+            as->code_off[2 * i] = as->code_off[2 * i + 1] = -1;
+
+        if (ln->op == OP_START || ln->op == OP_END) {
+            list_pos += fprintf(f_list, "%X\t%s\t%s\t%s\t-\n", ln->locctr, label, opcode,
+                                operand);
+            if (ln->op == OP_END)
+                break;
+            continue;
+        }
+
+        if (ln->op >= 0 || ln->op == OP_WORD)
+            asm_check_undefined(as, ln);
+        asm_check_range(as, ln);
+        int len = hex_off[i + 1] - hex_off[i] - 1;
+        int w = fprintf(f_list, "%X\t%s\t%s\t%s\t%s\n", ln->locctr, label, opcode, operand,
+                        object_code[0] == '\0' ? "-" : object_code);
+        if (as->code_off != NULL && len > 0)
+            as->code_off[2 * i] = list_pos + w - 1 - len;
+        list_pos += w;
+
+        if (len == 0) {
+            // RESW and RESB break both the text and binary records
+            if (ln->op == OP_RESW || ln->op == OP_RESB) {
+                trec_break(&trec);
+                if (f_bin != NULL)
+                    sicobj_break(&bin);
+            }
+            continue;
+        }
+
+        // Text (T) record, plus binary text and relocation records
+        int n = asm_hex_to_bytes(object_code, bytes);
+        trec_append(&trec, ln->locctr, bytes, n);
+        if (as->code_off != NULL && n <= TREC_MAX_BYTES)
+            as->code_off[2 * i + 1] = trec_pos(&trec) + TREC_PREFIX + 2 * (trec.rec_len - n);
+        if (f_bin != NULL) {
+            sicobj_text(&bin, ln->locctr, bytes, n);
+            // Only SIC-style format 3 addresses are relocated by the bitmap
+            if (ln->op >= 0 && asm_op_format(ln->op) == 3 && ln->mode == ADDR_SIMPLE &&
+                asm_operand_rel(as, ln))
+                sicobj_reloc(&bin, ln->locctr);
+        }
+    }
+
+    // Write last T-record (if any) and End (E) Record
+    trec_end(&trec, as->start_addr);
+    as->stats.trecords = trec.nrecords;
+    as->stats.obj_bytes = trec.bytes_written;
+    if (f_bin != NULL)
+        sicobj_end(&bin, as->start_addr, f_bin);
+
+    free(bytes);
+    free(hex);
+    free(hex_off);
+    free(chunks);
+    free(tids);
+    free(started);
+}
+
+// Pass 2: generate the listing and the H-T-E object program
+// Lines are encoded in parallel by 'nthreads' workers, each into its
+// own slot; the listing and T-records are then built in line order,
+// so the output does not depend on the thread count
+// If f_bin is not NULL the binary object program is written there too
+static inline void asm_pass2(struct Assembly *as, FILE *f_list, FILE *f_obj, FILE *f_bin,
+                             int nthreads) {
+    asm_pass2_from(as, NULL, f_list, f_obj, f_bin, nthreads);
+}
+
+// One-pass (load-and-go) assembly: pass 1 emits the object code and
+// resolves forward references, then the H-T-E records are written from
+// the image with the same T-record rules as pass 2
+// Returns 1 if errors were found, 0 otherwise
+static inline int asm_one_pass(struct Assembly *as, struct Lexer *lx, FILE *f_obj) {
+    struct TRecWriter trec;
+
+    as->one_pass = 1;
+    asm_pass1(as, lx);
+
+    // Any chain still pending belongs to a symbol that was never defined
+    for (int id = 0; id < as->fixup_head_cap && id < as->symtab.count; id++) {
+        if (as->fixup_head[id] >= 0) {
+            asm_error(as, "Undefined symbol '%s'", as->symtab.entries[id].name);
+        }
+    }
+
+    trec_begin(&trec, f_obj, as->prog_name, as->start_addr, as->prog_length);
+    for (int i = 0; i < as->nlines; i++) {
+        const struct AsmLine *ln = &as->lines[i];
+        int size = asm_line_size(as, ln);
+
+        asm_check_range(as, ln);
+        if (ln->op >= 0 || ln->op == OP_WORD || ln->op == OP_BYTE) {
+            if (size > 0)
+                trec_append(&trec, ln->locctr, as->image + (ln->locctr - as->start_addr), size);
+        } else if (ln->op == OP_RESW || ln->op == OP_RESB) {
+            trec_break(&trec);
+        }
+    }
+    trec_end(&trec, as->start_addr);
+    as->stats.trecords = trec.nrecords;
+    as->stats.obj_bytes = trec.bytes_written;
+
+    return as->error_flag;
+}
+
+#endif
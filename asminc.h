@@ -0,0 +1,467 @@
+/*
+ * Incremental reassembly (asm -i STATE)
+ *
+ * A run with -i saves the assembly in STATE: the line records, SYMTAB,
+ * the pass 1 checkpoints of asmcore.h (one every INC_CKPT_LINES lines,
+ * each with a hash of the source read since the one before) and where
+ * pass 2 put every line's object code in listing.txt and
+ * object_program.txt.
+ *
+ * The next run hashes the new source checkpoint by checkpoint and
+ * stops at the first stretch that differs. Everything up to the last
+ * matching checkpoint is unchanged text, so its line records and
+ * SYMTAB entries are taken from STATE and pass 1 resumes there. Pass 2
+ * then rewrites both output files in place from that checkpoint on.
+ * Of the lines before it, only those whose operand symbols changed
+ * value are encoded again, and their code is patched where it stands
+ * (a line's code keeps its width). An edit costs about as much as the
+ * part of the source after it; an edit at the end of a large program
+ * skips nearly all of the work.
+ *
+ * STATE is only trusted while listing.txt and object_program.txt have
+ * the size and modification time it recorded, and it is only kept
+ * after a run without errors; otherwise the run is a full one. The
+ * format is machine local (native structs), like any build cache.
+ */
+
+#ifndef ASMINC_H
+#define ASMINC_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "asmcore.h"
+
+#define INC_CKPT_LINES 4096 // Lines between pass 1 checkpoints
+#define INC_VERSION 1
+
+// Start of a state file; the arrays follow in the order of the counts,
+// each padded to 8 bytes
+struct IncHeader {
+    char magic[4];            // "SICI"
+    unsigned build;           // inc_build_hash() of the writer
+    int nlines, text_len, nexprs, nterms, nsyms, nlits, nckpts;
+    int start_addr, prog_length;
+    char prog_name[8];
+    long names_len;           // SYMTAB names, NUL-separated
+    long list_size, obj_size; // listing.txt and object_program.txt as written
+    long long list_mtime, obj_mtime;
+};
+
+// A loaded state file; the arrays point into 'buf'
+struct IncState {
+    char *buf;
+    const struct IncHeader *h;
+    const struct AsmLine *lines;
+    const char *text;
+    const struct AsmExpr *exprs;
+    const struct ExprTerm *terms;
+    const struct SymInfo *syms;
+    const int *values;        // SYMTAB values
+    const int *name_lens;
+    const char *names;
+    const int *lits;          // SYMTAB id of each LITTAB entry
+    const struct AsmCheckpoint *ckpts;
+    const long *code_off;
+    int resume;               // Checkpoint pass 1 resumed from, or -1
+    int reencoded;            // Earlier lines whose code was patched
+    long list_size, obj_size; // The output files after this run
+    long long list_mtime, obj_mtime;
+};
+
+// Hash of OPTAB and the record layouts, so a state file written by a
+// different build is ignored
+static inline unsigned inc_build_hash(void) {
+    unsigned layout[] = { INC_VERSION, sizeof(struct AsmLine), sizeof(struct SymInfo),
+                          sizeof(struct AsmCheckpoint), sizeof(long), OPTAB_SEED };
+    unsigned h = hash_name((const char *)layout, sizeof(layout));
+
+    for (int i = 0; i < OPTAB_SLOTS; i++) {
+        const struct OpInfo *e = &optab_entries[i];
+        if (e->name == NULL)
+            continue;
+        h = (h ^ hash_name(e->name, e->len)) * 16777619u;
+        h = (h ^ (unsigned)(e->opcode << 8 | e->format)) * 16777619u;
+    }
+    return h;
+}
+
+// Size and modification time (ns) of a file; returns -1 if it is missing
+static inline int inc_stat(const char *filename, long *size, long long *mtime) {
+    struct stat st;
+
+    if (stat(filename, &st) < 0)
+        return -1;
+    *size = st.st_size;
+    *mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 0;
+}
+
+// Next array of 'n' bytes in the file, or NULL if the file is too short
+static inline const void *inc_take(const struct IncState *st, long *pos, long size, long n) {
+    const char *p = st->buf + *pos;
+
+    if (n < 0 || n > size - *pos)
+        return NULL;
+    *pos += (n + 7) & ~7L;
+    return p;
+}
+
+// Load a state file and check it still matches the output files
+// Returns 0, or -1 if there is no usable state
+static inline int inc_load(struct IncState *st, const char *state_file) {
+    FILE *fp = fopen(state_file, "rb");
+    const struct IncHeader *h;
+    long size, pos = 0, list_size, obj_size;
+    long long list_mtime, obj_mtime;
+
+    memset(st, 0, sizeof(*st));
+    st->resume = -1;
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    st->buf = malloc(size > 0 ? size : 1);
+    if (size < (long)sizeof(struct IncHeader) || fread(st->buf, 1, size, fp) != (size_t)size) {
+        fclose(fp);
+        free(st->buf);
+        st->buf = NULL;
+        return -1;
+    }
+    fclose(fp);
+
+    h = st->h = inc_take(st, &pos, size, sizeof(struct IncHeader));
+    if (memcmp(h->magic, "SICI", 4) != 0 || h->build != inc_build_hash() || h->nlines < 0 ||
+        h->text_len < 0 || h->nexprs < 0 || h->nterms < 0 || h->nsyms < 0 || h->nlits < 0 ||
+        h->nckpts < 0)
+        goto bad;
+    st->lines = inc_take(st, &pos, size, (long)h->nlines * sizeof(struct AsmLine));
+    st->text = inc_take(st, &pos, size, h->text_len);
+    st->exprs = inc_take(st, &pos, size, (long)h->nexprs * sizeof(struct AsmExpr));
+    st->terms = inc_take(st, &pos, size, (long)h->nterms * sizeof(struct ExprTerm));
+    st->syms = inc_take(st, &pos, size, (long)h->nsyms * sizeof(struct SymInfo));
+    st->values = inc_take(st, &pos, size, (long)h->nsyms * sizeof(int));
+    st->name_lens = inc_take(st, &pos, size, (long)h->nsyms * sizeof(int));
+    st->names = inc_take(st, &pos, size, h->names_len);
+    st->lits = inc_take(st, &pos, size, (long)h->nlits * sizeof(int));
+    st->ckpts = inc_take(st, &pos, size, (long)h->nckpts * sizeof(struct AsmCheckpoint));
+    st->code_off = inc_take(st, &pos, size, 2L * h->nlines * sizeof(long));
+    if (st->code_off == NULL || pos != size)
+        goto bad;
+
+    // The outputs must be the ones this state describes
+    if (inc_stat("listing.txt", &list_size, &list_mtime) < 0 ||
+        inc_stat("object_program.txt", &obj_size, &obj_mtime) < 0 ||
+        list_size != h->list_size || list_mtime != h->list_mtime ||
+        obj_size != h->obj_size || obj_mtime != h->obj_mtime)
+        goto bad;
+    return 0;
+
+bad:
+    free(st->buf);
+    st->buf = NULL;
+    return -1;
+}
+
+// Find the last checkpoint whose source up to it is unchanged
+static inline void inc_pick(struct IncState *st, const struct Lexer *lx) {
+    long prev = 0, size = lx->end - lx->buf;
+
+    for (int k = 0; k < st->h->nckpts; k++) {
+        const struct AsmCheckpoint *c = &st->ckpts[k];
+        if (c->src_off < prev || c->src_off > size || c->nlines > st->h->nlines ||
+            c->text_len > st->h->text_len || c->nexprs > st->h->nexprs ||
+            c->nterms > st->h->nterms || c->nsyms > st->h->nsyms || c->nlits > st->h->nlits ||
+            hash_bytes(lx->buf + prev, c->src_off - prev) != c->src_hash)
+            break;
+        st->resume = k;
+        prev = c->src_off;
+    }
+}
+
+// Rebuild the assembly as pass 1 left it at the resume checkpoint and
+// move the lexer there
+static inline void inc_restore(const struct IncState *st, struct Assembly *as, struct Lexer *lx) {
+    const struct AsmCheckpoint *c = &st->ckpts[st->resume];
+    const char *name = st->names;
+    int n = c->nlines;
+
+    as->lines_cap = n + 256;
+    as->lines = realloc(as->lines, as->lines_cap * sizeof(struct AsmLine));
+    memcpy(as->lines, st->lines, n * sizeof(struct AsmLine));
+    as->nlines = n;
+    as->text_cap = c->text_len + 4096;
+    as->text = realloc(as->text, as->text_cap);
+    memcpy(as->text, st->text, c->text_len);
+    as->text_len = c->text_len;
+    as->exprs_cap = c->nexprs + 64;
+    as->exprs = malloc(as->exprs_cap * sizeof(struct AsmExpr));
+    memcpy(as->exprs, st->exprs, c->nexprs * sizeof(struct AsmExpr));
+    as->nexprs = c->nexprs;
+    as->terms_cap = c->nterms + 256;
+    as->terms = malloc(as->terms_cap * sizeof(struct ExprTerm));
+    memcpy(as->terms, st->terms, c->nterms * sizeof(struct ExprTerm));
+    as->nterms = c->nterms;
+
+    // SYMTAB as of line n: later definitions are undone, EQU symbols
+    // resolved later are pending again
+    tab_free(&as->symtab);
+    tab_init(&as->symtab, c->nsyms > 1024 ? c->nsyms : 1024);
+    if (c->nsyms > 0)
+        asm_sym_info(as, c->nsyms - 1);
+    for (int id = 0; id < c->nsyms; id++) {
+        const struct SymInfo *old = &st->syms[id];
+        struct SymInfo *si = &as->syms[id];
+        int value = 0;
+
+        if (old->line >= 0 && old->line < n && old->set_at >= 0 && old->set_at <= n) {
+            *si = *old;
+            value = st->values[id];
+        } else if (old->line >= 0 && old->line < n && old->expr >= 0) {
+            si->expr = old->expr;
+            si->state = SYM_PENDING;
+            si->line = old->line;
+        }
+        tab_add(&as->symtab, name, st->name_lens[id], value);
+        name += st->name_lens[id] + 1;
+    }
+    for (int k = 0; k < c->nlits; k++) {
+        const struct TabEntry *e = &as->symtab.entries[st->lits[k]];
+        tab_add(&as->littab, e->name, e->len, st->lits[k]);
+    }
+    as->symtab.lookups = as->symtab.probes = 0;
+    as->littab.lookups = as->littab.probes = 0;
+    as->lit_next = c->lit_next;
+
+    as->start_addr = st->h->start_addr;
+    memcpy(as->prog_name, st->h->prog_name, sizeof(as->prog_name));
+    as->prog_name[sizeof(as->prog_name) - 1] = '\0';
+    as->ckpts_cap = st->resume + 64;
+    as->ckpts = malloc(as->ckpts_cap * sizeof(struct AsmCheckpoint));
+    memcpy(as->ckpts, st->ckpts, (st->resume + 1) * sizeof(struct AsmCheckpoint));
+    as->nckpts = st->resume + 1;
+    as->code_off = malloc(2 * (n + 1) * sizeof(long));
+    memcpy(as->code_off, st->code_off, 2 * n * sizeof(long));
+
+    lx->cur = lx->buf + c->src_off;
+    lx->line_no = c->line_no;
+}
+
+// Pass 1, resumed from the state file where the source is unchanged
+// Returns 1 if errors were found, 0 otherwise
+static inline int inc_pass1(struct IncState *st, struct Assembly *as, struct Lexer *lx,
+                            const char *state_file) {
+    struct AsmCheckpoint at;
+
+    as->ckpt_every = INC_CKPT_LINES;
+    if (inc_load(st, state_file) == 0)
+        inc_pick(st, lx);
+    if (st->resume < 0)
+        return asm_pass1(as, lx);
+
+    inc_restore(st, as, lx);
+    as->stats.bytes_read += lx->end - lx->cur;
+    at = as->ckpts[st->resume];
+    return asm_pass1_run(as, lx, &at, NULL);
+}
+
+// Does a line use a symbol whose value changed?
+static inline int inc_uses_changed(const struct Assembly *as, const struct AsmLine *ln,
+                                   const unsigned char *changed) {
+    if (ln->expr >= 0) {
+        const struct ExprTerm *t = &as->terms[as->exprs[ln->expr].first];
+        for (int i = 0; i < as->exprs[ln->expr].n; i++, t++)
+            if (t->sym >= 0 && changed[t->sym])
+                return 1;
+        return 0;
+    }
+    return ln->sym >= 0 && changed[ln->sym];
+}
+
+// Re-encode the lines before the resume checkpoint whose symbols moved
+// and patch their code in both files (or in the checkpoint's open
+// T-record, which pass 2 writes again); the H record gets the new length
+// A line in the open T-record of an earlier checkpoint is patched there
+// too, so a later run resuming from that one writes the new code
+// The files are written with pwrite(), before pass 2 uses their streams
+static inline void inc_patch(struct IncState *st, struct Assembly *as, FILE *f_list,
+                             FILE *f_obj) {
+    struct AsmCheckpoint *c = &as->ckpts[st->resume];
+    unsigned char *changed = calloc(c->nsyms + 1, 1);
+    char hex[2 * 4 + 1]; // Instructions and WORD take at most 4 bytes
+
+    for (int id = 0; id < c->nsyms; id++) {
+        int now = asm_sym_has_value(as, id);
+        changed[id] = st->syms[id].defined != now ||
+                      (now && st->values[id] != as->symtab.entries[id].value);
+    }
+    for (int i = 0, k = 0; i < c->nlines; i++) {
+        const struct AsmLine *ln = &as->lines[i];
+        long pos = as->code_off[2 * i + 1];
+
+        if (!(ln->op >= 0 || ln->op == OP_WORD) || !inc_uses_changed(as, ln, changed))
+            continue;
+        while (as->ckpts[k].nlines <= i) // First checkpoint after the line
+            k++;
+        asm_check_undefined(as, ln);
+        asm_check_range(as, ln);
+        asm_encode(as, ln, hex);
+        if (as->code_off[2 * i] >= 0 &&
+            pwrite(fileno(f_list), hex, strlen(hex), as->code_off[2 * i]) < 0)
+            as->error_flag = 1;
+        if (pos >= 0 && pos >= as->ckpts[k].obj_off)
+            asm_encode_bytes(as, ln, as->ckpts[k].rec + (ln->locctr - as->ckpts[k].rec_addr));
+        if (pos >= 0 && pos < c->obj_off && pwrite(fileno(f_obj), hex, strlen(hex), pos) < 0)
+            as->error_flag = 1;
+        st->reencoded++;
+    }
+    free(changed);
+
+    snprintf(hex, sizeof(hex), "%06X", as->prog_length & 0xFFFFFF);
+    if (pwrite(fileno(f_obj), hex, 6, 16) < 0) // After "H^NAME  ^SSSSSS^"
+        as->error_flag = 1;
+}
+
+// Pass 2, rewriting the output files from the resume checkpoint on
+// Returns the bytes written, or -1 if an output file cannot be opened
+static inline long inc_pass2(struct IncState *st, struct Assembly *as, int nthreads) {
+    FILE *f_list = NULL, *f_obj = NULL;
+    long bytes;
+
+    // The H record is patched in place only while it keeps its width
+    if (st->resume >= 0 && (as->prog_length > 0xFFFFFF || st->h->prog_length > 0xFFFFFF))
+        st->resume = -1;
+    if (st->resume >= 0) {
+        f_list = fopen("listing.txt", "r+");
+        f_obj = fopen("object_program.txt", "r+");
+    }
+    if (f_list == NULL || f_obj == NULL) {
+        // Full pass 2 over the finished pass 1
+        if (f_list) fclose(f_list);
+        if (f_obj) fclose(f_obj);
+        st->resume = -1;
+        f_list = fopen("listing.txt", "w");
+        f_obj = fopen("object_program.txt", "w");
+        if (!f_list || !f_obj) {
+            if (f_list) fclose(f_list);
+            if (f_obj) fclose(f_obj);
+            return -1;
+        }
+        asm_pass2(as, f_list, f_obj, NULL, nthreads);
+        bytes = ftell(f_list) + ftell(f_obj);
+    } else {
+        struct AsmCheckpoint *c = &as->ckpts[st->resume];
+        long list_off = c->list_off, obj_off = c->obj_off;
+
+        inc_patch(st, as, f_list, f_obj);
+        fseek(f_list, list_off, SEEK_SET);
+        fseek(f_obj, obj_off, SEEK_SET);
+        asm_pass2_from(as, c, f_list, f_obj, NULL, nthreads);
+        fflush(f_list);
+        fflush(f_obj);
+        bytes = ftell(f_list) - list_off + ftell(f_obj) - obj_off;
+        if (ftruncate(fileno(f_list), ftell(f_list)) < 0 ||
+            ftruncate(fileno(f_obj), ftell(f_obj)) < 0)
+            as->error_flag = 1; // The old tail would stay behind
+    }
+    fclose(f_list);
+    fclose(f_obj);
+    inc_stat("listing.txt", &st->list_size, &st->list_mtime);
+    inc_stat("object_program.txt", &st->obj_size, &st->obj_mtime);
+    return bytes;
+}
+
+// Write an array padded to 8 bytes (p = NULL: the padding only)
+static inline void inc_write(FILE *fp, const void *p, long n) {
+    static const char pad[8];
+
+    if (p != NULL && n > 0)
+        fwrite(p, 1, n, fp);
+    fwrite(pad, 1, ((n + 7) & ~7L) - n, fp);
+}
+
+// Save the state for the next run (written to a temporary file, then
+// renamed); after errors the state file is removed instead
+// Returns 0 on success, -1 on error
+static inline int inc_save(const struct IncState *st, struct Assembly *as,
+                           const char *state_file) {
+    char tmp[4096];
+    struct IncHeader h;
+    FILE *fp;
+    int nsyms = as->symtab.count;
+
+    if (as->error_flag || as->code_off == NULL) {
+        remove(state_file);
+        return 0;
+    }
+    snprintf(tmp, sizeof(tmp), "%s.tmp", state_file);
+    if ((fp = fopen(tmp, "wb")) == NULL)
+        return -1;
+
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, "SICI", 4);
+    h.build = inc_build_hash();
+    h.nlines = as->nlines;
+    h.text_len = as->text_len;
+    h.nexprs = as->nexprs;
+    h.nterms = as->nterms;
+    h.nsyms = nsyms;
+    h.nlits = as->littab.count;
+    h.nckpts = as->nckpts;
+    h.start_addr = as->start_addr;
+    h.prog_length = as->prog_length;
+    memcpy(h.prog_name, as->prog_name, sizeof(h.prog_name));
+    for (int id = 0; id < nsyms; id++)
+        h.names_len += as->symtab.entries[id].len + 1;
+    h.list_size = st->list_size;
+    h.list_mtime = st->list_mtime;
+    h.obj_size = st->obj_size;
+    h.obj_mtime = st->obj_mtime;
+
+    int *values = malloc((nsyms + 1) * sizeof(int));
+    int *lens = malloc((nsyms + 1) * sizeof(int));
+    int *lits = malloc((as->littab.count + 1) * sizeof(int));
+    if (nsyms > 0)
+        asm_sym_info(as, nsyms - 1);
+    for (int id = 0; id < nsyms; id++) {
+        values[id] = as->symtab.entries[id].value;
+        lens[id] = as->symtab.entries[id].len;
+    }
+    for (int k = 0; k < as->littab.count; k++)
+        lits[k] = as->littab.entries[k].value;
+
+    inc_write(fp, &h, sizeof(h));
+    inc_write(fp, as->lines, (long)as->nlines * sizeof(struct AsmLine));
+    inc_write(fp, as->text, as->text_len);
+    inc_write(fp, as->exprs, (long)as->nexprs * sizeof(struct AsmExpr));
+    inc_write(fp, as->terms, (long)as->nterms * sizeof(struct ExprTerm));
+    inc_write(fp, as->syms, (long)nsyms * sizeof(struct SymInfo));
+    inc_write(fp, values, (long)nsyms * sizeof(int));
+    inc_write(fp, lens, (long)nsyms * sizeof(int));
+    for (int id = 0; id < nsyms; id++)
+        fwrite(as->symtab.entries[id].name, 1, as->symtab.entries[id].len + 1, fp);
+    inc_write(fp, NULL, h.names_len); // Padding only
+    inc_write(fp, lits, (long)as->littab.count * sizeof(int));
+    inc_write(fp, as->ckpts, (long)as->nckpts * sizeof(struct AsmCheckpoint));
+    inc_write(fp, as->code_off, 2L * as->nlines * sizeof(long));
+    free(values);
+    free(lens);
+    free(lits);
+
+    if (fclose(fp) != 0 || rename(tmp, state_file) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static inline void inc_free(struct IncState *st) {
+    free(st->buf);
+    st->buf = NULL;
+}
+
+#endif
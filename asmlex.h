@@ -0,0 +1,174 @@
+/*
+ * Zero-copy tokenizer for assembler source files
+ *
+ * The source file is mmap'ed and scanned byte by byte. Each call to
+ * lex_next() returns the fields of the next statement as string views
+ * pointing straight into the mapping; nothing is copied.
+ *
+ * Source format:
+ * - Fields are separated by blanks or tabs, one statement per line
+ * - A field starting with '.' begins a comment that runs to the end of
+ *   the line (a whole-line comment when it is the first field)
+ * - Anything after the third field is a comment
+ * - Quoted text (C'A B') is kept as part of its field
+ * - A line that starts with a blank has no label column
+ * - Lines may have 1, 2 or 3 fields; the caller decides which of
+ *   label/opcode/operand they are
+ */
+
+#ifndef ASMLEX_H
+#define ASMLEX_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// A (not NUL-terminated) slice of the source
+struct StrView {
+    const char *p;
+    int len;
+};
+
+struct Lexer {
+    const char *buf;  // Start of the mapping
+    const char *cur;  // Scan position
+    const char *end;
+    size_t size;
+    int line_no;      // Line number of the last statement returned
+    int indented;     // Last statement started with a blank (no label)
+};
+
+// Map a source file for scanning
+// Returns 0 on success, -1 if the file cannot be opened or mapped
+static inline int lex_open(struct Lexer *lx, const char *filename) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    memset(lx, 0, sizeof(*lx));
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    lx->size = st.st_size;
+    if (lx->size > 0) {
+        void *p = mmap(NULL, lx->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) {
+            close(fd);
+            return -1;
+        }
+        madvise(p, lx->size, MADV_SEQUENTIAL);
+        lx->buf = p;
+    }
+    close(fd);
+
+    lx->cur = lx->buf;
+    lx->end = lx->buf + lx->size;
+    return 0;
+}
+
+// Scan an in-memory buffer instead of a file (buffer is not owned)
+static inline void lex_init_buffer(struct Lexer *lx, const char *buf, size_t size) {
+    memset(lx, 0, sizeof(*lx));
+    lx->cur = lx->buf = buf;
+    lx->end = buf + size;
+}
+
+static inline void lex_close(struct Lexer *lx) {
+    if (lx->size > 0)
+        munmap((void *)lx->buf, lx->size);
+    memset(lx, 0, sizeof(*lx));
+}
+
+// Read the next statement; fields[] receives up to 3 views
+// Returns the number of fields (1-3), or 0 at end of input
+static inline int lex_next(struct Lexer *lx, struct StrView fields[3]) {
+    const char *p = lx->cur, *end = lx->end;
+
+    while (p < end) {
+        int n = 0;
+        lx->line_no++;
+        lx->indented = (*p == ' ' || *p == '\t');
+
+        while (p < end && *p != '\n') {
+            // Skip blanks between fields
+            while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+                p++;
+            if (p >= end || *p == '\n')
+                break;
+
+            // '.' starts a comment, whole-line or trailing
+            if (*p == '.')
+                break;
+            if (n == 3)
+                break; // Trailing comment
+
+            const char *start = p;
+            while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+                if (*p++ == '\'') {
+                    // Keep quoted text together, blanks included
+                    while (p < end && *p != '\'' && *p != '\n')
+                        p++;
+                    if (p < end && *p == '\'')
+                        p++;
+                }
+            }
+            fields[n].p = start;
+            fields[n].len = p - start;
+            n++;
+        }
+
+        // Skip the rest of the line (comment text and the newline)
+        while (p < end && *p != '\n')
+            p++;
+        if (p < end)
+            p++;
+
+        if (n > 0) {
+            lx->cur = p;
+            return n;
+        }
+    }
+    lx->cur = p;
+    return 0;
+}
+
+// Compare a view with a C string
+static inline int view_eq(struct StrView v, const char *s) {
+    return (int)strlen(s) == v.len && memcmp(v.p, s, v.len) == 0;
+}
+
+// View of a whole C string
+static inline struct StrView view_of(const char *s) {
+    struct StrView v = { s, (int)strlen(s) };
+    return v;
+}
+
+// Parse an optionally signed integer from a view in the given base
+static inline int view_int(struct StrView v, int base) {
+    int value = 0, i = 0, neg = 0;
+
+    if (v.len > 0 && (v.p[0] == '-' || v.p[0] == '+')) {
+        neg = v.p[0] == '-';
+        i = 1;
+    }
+    for (; i < v.len; i++) {
+        int c = v.p[i], d;
+        if (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else break;
+        if (d >= base)
+            break;
+        value = value * base + d;
+    }
+    return neg ? -value : value;
+}
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Assembler statistics (--stats)
+ *
+ * The driver takes a clock reading between phases; the report combines
+ * those with the counters an Assembly keeps (OPTAB and SYMTAB lookups,
+ * bytes read, T-records) and writes one JSON object, so build scripts
+ * can collect it without parsing the human-readable messages.
+ *
+ * Wall time is CLOCK_MONOTONIC; CPU time is the process CPU clock, so
+ * it includes every pass 2 worker thread.
+ *
+ * SYMTAB reports its average probe length. OPTAB does not: the generated
+ * table has no collisions, so every lookup reads exactly one slot.
+ * Its lookup count includes those the macro expander makes (-M).
+ */
+
+#ifndef ASMSTATS_H
+#define ASMSTATS_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "asmcore.h"
+
+// A clock reading taken at a phase boundary
+struct PhaseMark {
+    double wall;   // Seconds
+    double cpu;
+};
+
+static inline void phase_mark(struct PhaseMark *m) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    m->wall = ts.tv_sec + ts.tv_nsec / 1e9;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    m->cpu = ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Write a JSON string, escaping quotes, backslashes and control bytes
+static inline void stats_json_string(FILE *fp, const char *s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        unsigned char c = *s;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+// Write the report; phase i runs from marks[i] to marks[i + 1]
+static inline void stats_write_json(FILE *fp, const struct Assembly *as, const char *source,
+                                    const char **phases, const struct PhaseMark *marks,
+                                    int nphases, long bytes_written) {
+    const struct HashTab *st = &as->symtab;
+
+    fprintf(fp, "{\n  \"source\": ");
+    stats_json_string(fp, source);
+    fprintf(fp, ",\n  \"program\": ");
+    stats_json_string(fp, as->prog_name);
+    fprintf(fp, ",\n  \"lines\": %d,\n  \"errors\": %d,\n", as->nlines, as->error_flag);
+
+    fprintf(fp, "  \"phases\": {\n");
+    for (int i = 0; i <= nphases; i++) {
+        // The last entry is the whole run
+        const struct PhaseMark *a = &marks[i < nphases ? i : 0];
+        const struct PhaseMark *b = &marks[i < nphases ? i + 1 : nphases];
+        fprintf(fp, "    \"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }%s\n",
+                i < nphases ? phases[i] : "total", (b->wall - a->wall) * 1e3,
+                (b->cpu - a->cpu) * 1e3, i < nphases ? "," : "");
+    }
+    fprintf(fp, "  },\n");
+
+    fprintf(fp, "  \"optab\": { \"entries\": %d, \"lookups\": %ld },\n", OPTAB_COUNT,
+            as->stats.optab_lookups);
+    fprintf(fp, "  \"symtab\": { \"symbols\": %d, \"lookups\": %ld, \"avg_probe\": %.3f },\n",
+            st->count, st->lookups, st->lookups ? (double)st->probes / st->lookups : 0.0);
+    fprintf(fp, "  \"literals\": %d,\n", as->littab.count);
+    fprintf(fp, "  \"bytes_read\": %ld,\n  \"bytes_written\": %ld,\n", as->stats.bytes_read,
+            bytes_written);
+    fprintf(fp, "  \"object_bytes\": %ld,\n  \"t_records\": %ld\n}\n", as->stats.obj_bytes,
+            as->stats.trecords);
+}
+
+#endif
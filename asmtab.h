@@ -0,0 +1,162 @@
+/*
+ * In-memory SYMTAB (and LITTAB) for the two-pass assembler
+ *
+ * An open-addressing hash table (linear probing) over a flat array of
+ * entries. Entries keep their insertion order, so an entry's index
+ * doubles as a stable id and SYMTAB can still be written out in the
+ * order the labels were defined. OPTAB is generated at build time
+ * instead (optab_gen.h).
+ *
+ * Every lookup is counted together with the slots it probed, for the
+ * assembler's --stats report.
+ */
+
+#ifndef ASMTAB_H
+#define ASMTAB_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+struct TabEntry {
+    char *name;
+    int len;
+    int value;
+};
+
+struct HashTab {
+    struct TabEntry *entries; // Entries in insertion order
+    int count, cap;
+    int *slots;               // Entry index + 1, 0 = empty slot
+    int nslots;               // Always a power of two
+    long lookups, probes;     // Statistics: lookups and slots probed
+};
+
+// FNV-1a hash of a (not necessarily NUL-terminated) name
+static inline unsigned hash_name(const char *name, int len) {
+    unsigned h = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// 64-bit hash of a byte range, one 8-byte word per step; used to tell
+// whether a stretch of source changed (incremental reassembly)
+static inline unsigned long long hash_bytes(const char *p, size_t len) {
+    unsigned long long h = 14695981039346656037ull ^ len, w;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, p + i, 8);
+        h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+        h ^= h >> 29;
+    }
+    for (; i < len; i++)
+        h = (h ^ (unsigned char)p[i]) * 0x100000001B3ull;
+    return h ^ (h >> 32);
+}
+
+// Initialize an empty table sized for about 'hint' entries
+static inline void tab_init(struct HashTab *t, int hint) {
+    t->nslots = 16;
+    while (t->nslots < hint * 2)
+        t->nslots <<= 1;
+    t->slots = calloc(t->nslots, sizeof(int));
+    t->cap = hint > 8 ? hint : 8;
+    t->entries = malloc(t->cap * sizeof(struct TabEntry));
+    t->count = 0;
+    t->lookups = t->probes = 0;
+}
+
+static inline void tab_free(struct HashTab *t) {
+    for (int i = 0; i < t->count; i++)
+        free(t->entries[i].name);
+    free(t->entries);
+    free(t->slots);
+    t->entries = NULL;
+    t->slots = NULL;
+    t->count = t->cap = t->nslots = 0;
+}
+
+// Returns the slot holding 'name', or the empty slot where it would go
+static inline int tab_probe(struct HashTab *t, const char *name, int len) {
+    unsigned mask = t->nslots - 1;
+    unsigned i = hash_name(name, len) & mask;
+
+    t->lookups++;
+    t->probes++;
+    while (t->slots[i] != 0) {
+        const struct TabEntry *e = &t->entries[t->slots[i] - 1];
+        if (e->len == len && memcmp(e->name, name, len) == 0)
+            break;
+        i = (i + 1) & mask;
+        t->probes++;
+    }
+    return i;
+}
+
+// Returns the entry index of 'name', or -1 if not present
+static inline int tab_find(struct HashTab *t, const char *name, int len) {
+    int slot = tab_probe(t, name, len);
+    return t->slots[slot] - 1;
+}
+
+// Double the slot array and rehash every entry
+static inline void tab_grow(struct HashTab *t) {
+    long lookups = t->lookups, probes = t->probes; // Rehashing is not a lookup
+
+    free(t->slots);
+    t->nslots <<= 1;
+    t->slots = calloc(t->nslots, sizeof(int));
+    for (int i = 0; i < t->count; i++) {
+        int slot = tab_probe(t, t->entries[i].name, t->entries[i].len);
+        t->slots[slot] = i + 1;
+    }
+    t->lookups = lookups;
+    t->probes = probes;
+}
+
+// Add a new entry and return its index, or -1 if 'name' already exists
+static inline int tab_add(struct HashTab *t, const char *name, int len, int value) {
+    int slot = tab_probe(t, name, len);
+    if (t->slots[slot] != 0)
+        return -1;
+
+    if (t->count == t->cap) {
+        t->cap *= 2;
+        t->entries = realloc(t->entries, t->cap * sizeof(struct TabEntry));
+    }
+    struct TabEntry *e = &t->entries[t->count];
+    e->name = malloc(len + 1);
+    memcpy(e->name, name, len);
+    e->name[len] = '\0';
+    e->len = len;
+    e->value = value;
+    t->slots[slot] = ++t->count;
+
+    // Keep the load factor at or below 1/2
+    if (t->count * 2 > t->nslots)
+        tab_grow(t);
+    return t->count - 1;
+}
+
+// Load "name value" pairs from a file; values are parsed in 'base'
+// Returns the number of entries read, or -1 if the file cannot be opened
+static inline int tab_load(struct HashTab *t, const char *filename, int base) {
+    char name[64], value[32];
+    FILE *fp = fopen(filename, "r");
+    if (fp == NULL)
+        return -1;
+
+    int n = 0;
+    while (fscanf(fp, "%63s %31s", name, value) == 2) {
+        tab_add(t, name, strlen(name), (int)strtol(value, NULL, base));
+        n++;
+    }
+    fclose(fp);
+    return n;
+}
+
+#endif
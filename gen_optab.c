@@ -0,0 +1,142 @@
+/*
+ * OPTAB Generator
+ *
+ * Reads the opcode table (one "mnemonic opcode format" line per
+ * instruction, opcode in hex, format 1/2/3) and writes a C header with
+ * a perfect hash table over the mnemonics: a seed is searched for so
+ * that every mnemonic lands in its own slot, and lookup is a single
+ * hash, one probe and one compare.
+ *
+ * Usage: gen_optab [optab.txt] > optab_gen.h
+ *
+ * Rerun it whenever optab.txt changes; the assemblers include the
+ * generated optab_gen.h and never read optab.txt themselves.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define MAX_OPS 256
+#define MAX_SEEDS 1000000
+
+struct Op {
+    char name[16];
+    int opcode;
+    int format;
+};
+
+// Same hash as optab_hash() in the generated header
+unsigned seeded_hash(const char *s, int len, unsigned seed) {
+    unsigned h = 2166136261u ^ seed;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+// Returns 1 if 'seed' maps every mnemonic to its own slot of 'nslots'
+int try_seed(const struct Op *ops, int n, unsigned seed, int nslots, int *slot_of) {
+    char used[4 * MAX_OPS] = { 0 };
+    for (int i = 0; i < n; i++) {
+        int s = seeded_hash(ops[i].name, strlen(ops[i].name), seed) & (nslots - 1);
+        if (used[s])
+            return 0;
+        used[s] = 1;
+        slot_of[i] = s;
+    }
+    return 1;
+}
+
+int main(int argc, char *argv[]) {
+    const char *filename = argc > 1 ? argv[1] : "optab.txt";
+    struct Op ops[MAX_OPS];
+    int slot_of[MAX_OPS], n = 0, nslots = 1;
+    unsigned seed = 0;
+    char name[16], code[8];
+    int format;
+    FILE *fp = fopen(filename, "r");
+
+    if (fp == NULL) {
+        fprintf(stderr, "Error: Cannot open %s\n", filename);
+        return 1;
+    }
+    while (fscanf(fp, "%15s %7s %d", name, code, &format) == 3) {
+        if (n == MAX_OPS) {
+            fprintf(stderr, "Error: More than %d opcodes\n", MAX_OPS);
+            return 1;
+        }
+        if (format < 1 || format > 3) {
+            fprintf(stderr, "Error: Bad format %d for %s\n", format, name);
+            return 1;
+        }
+        strcpy(ops[n].name, name);
+        ops[n].opcode = (int)strtol(code, NULL, 16);
+        ops[n].format = format;
+        n++;
+    }
+    fclose(fp);
+
+    // Smallest power-of-two table for which a collision-free seed exists
+    while (nslots < n)
+        nslots <<= 1;
+    for (;;) {
+        for (seed = 1; seed <= MAX_SEEDS; seed++)
+            if (try_seed(ops, n, seed, nslots, slot_of))
+                break;
+        if (seed <= MAX_SEEDS || nslots == 4 * MAX_OPS)
+            break;
+        nslots <<= 1;
+    }
+    if (seed > MAX_SEEDS) {
+        fprintf(stderr, "Error: No perfect hash found\n");
+        return 1;
+    }
+
+    printf("/*\n");
+    printf(" * SIC/XE opcode table -- generated by gen_optab from %s, do not edit\n", filename);
+    printf(" *\n");
+    printf(" * Perfect hash: %d mnemonics in %d slots, seed %u.\n", n, nslots, seed);
+    printf(" */\n\n");
+    printf("#ifndef OPTAB_GEN_H\n#define OPTAB_GEN_H\n\n");
+    printf("#include <string.h>\n\n");
+    printf("#define OPTAB_COUNT %d\n", n);
+    printf("#define OPTAB_SLOTS %d\n", nslots);
+    printf("#define OPTAB_SEED %uu\n\n", seed);
+    printf("struct OpInfo {\n");
+    printf("    const char *name;  // NULL for an empty slot\n");
+    printf("    int len;\n");
+    printf("    int opcode;\n");
+    printf("    int format;        // 1, 2 or 3 (3 also allows +format 4)\n");
+    printf("};\n\n");
+    printf("static const struct OpInfo optab_entries[OPTAB_SLOTS] = {\n");
+    for (int s = 0; s < nslots; s++) {
+        int i;
+        for (i = 0; i < n && slot_of[i] != s; i++)
+            ;
+        if (i < n)
+            printf("    { \"%s\", %d, 0x%02X, %d },\n", ops[i].name,
+                   (int)strlen(ops[i].name), ops[i].opcode, ops[i].format);
+        else
+            printf("    { 0, 0, 0, 0 },\n");
+    }
+    printf("};\n\n");
+    printf("static inline unsigned optab_hash(const char *s, int len) {\n");
+    printf("    unsigned h = 2166136261u ^ OPTAB_SEED;\n");
+    printf("    for (int i = 0; i < len; i++) {\n");
+    printf("        h ^= (unsigned char)s[i];\n");
+    printf("        h *= 16777619u;\n");
+    printf("    }\n");
+    printf("    return h ^ (h >> 15);\n");
+    printf("}\n\n");
+    printf("// Returns the slot of a mnemonic, or -1 if it is not an instruction\n");
+    printf("static inline int optab_lookup(const char *s, int len) {\n");
+    printf("    int slot = optab_hash(s, len) & (OPTAB_SLOTS - 1);\n");
+    printf("    const struct OpInfo *e = &optab_entries[slot];\n");
+    printf("    return e->name && e->len == len && memcmp(e->name, s, len) == 0 ? slot : -1;\n");
+    printf("}\n\n");
+    printf("#endif\n");
+
+    return 0;
+}
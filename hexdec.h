@@ -0,0 +1,190 @@
+/*
+ * ASCII hex to binary decoding for the loaders
+ *
+ * hex_decode() turns 2 * n hex digits (either case) into n bytes and
+ * checks every character on the way. On x86 the work is done 16 or 32
+ * characters per vector step:
+ *
+ *   1. Fold letters to lower case (c | 0x20; digits already have the bit)
+ *   2. Classify: '0'-'9' or 'a'-'f', else the input is rejected
+ *   3. Value: c - '0', minus 39 more for letters
+ *   4. Pair adjacent nibbles inside 16-bit lanes (hi << 4 | lo) and
+ *      pack the lanes down to bytes
+ *
+ * The kernel is chosen once at run time from CPUID: AVX2 (32 digits per
+ * step), SSE2 (16; always present on x86-64) or portable scalar code.
+ * Setting HEXDEC=scalar|sse2|avx2 in the environment forces one, for
+ * testing. All three give identical results.
+ */
+
+#ifndef HEXDEC_H
+#define HEXDEC_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HEXDEC_X86 1
+#endif
+
+// Value of one hex digit, or -1
+static inline int hex_digit(unsigned char c) {
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+// Value of a field of exactly 'n' hex digits (n <= 7), or -1
+static inline int hex_field(const char *p, int n) {
+    int v = 0;
+
+    for (int i = 0; i < n; i++) {
+        int d = hex_digit(p[i]);
+        if (d < 0)
+            return -1;
+        v = (v << 4) | d;
+    }
+    return v;
+}
+
+// Branch-free digit test and value (the value is only meaningful for
+// valid digits: letters have bit 6 set and need 9 added to their low nibble)
+static inline int hex_is_digit(unsigned char c) {
+    return ((unsigned)(c - '0') < 10) | ((unsigned)((c | 0x20) - 'a') < 6);
+}
+
+static inline int hex_nibble(unsigned char c) {
+    return (c & 0xF) + 9 * (c >> 6);
+}
+
+static inline int hex_decode_scalar(unsigned char *dst, const char *src, size_t n) {
+    int ok = 1;
+
+    for (size_t i = 0; i < n; i++) {
+        unsigned char hi = src[2 * i], lo = src[2 * i + 1];
+        ok &= hex_is_digit(hi) & hex_is_digit(lo);
+        dst[i] = hex_nibble(hi) << 4 | hex_nibble(lo);
+    }
+    return ok ? 0 : -1;
+}
+
+#ifdef HEXDEC_X86
+
+// Nibble values of 16 characters; clears *ok if one is not a hex digit
+__attribute__((target("sse2")))
+static inline __m128i hex_nibbles_sse2(__m128i c, int *ok) {
+    __m128i l = _mm_or_si128(c, _mm_set1_epi8(0x20));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+    __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), l));
+
+    if (_mm_movemask_epi8(_mm_or_si128(digit, alpha)) != 0xFFFF)
+        *ok = 0;
+    return _mm_sub_epi8(_mm_sub_epi8(l, _mm_set1_epi8('0')),
+                        _mm_and_si128(alpha, _mm_set1_epi8('a' - '0' - 10)));
+}
+
+// hi << 4 | lo for the 8 digit pairs of a vector, one per 16-bit lane
+__attribute__((target("sse2")))
+static inline __m128i hex_pairs_sse2(__m128i v) {
+    return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(v, _mm_set1_epi16(0x00FF)), 4),
+                        _mm_srli_epi16(v, 8));
+}
+
+__attribute__((target("sse2")))
+static inline int hex_decode_sse2(unsigned char *dst, const char *src, size_t n) {
+    int ok = 1;
+    size_t i = 0;
+
+    // 32 digits -> 16 bytes per step
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * i)), &ok);
+        __m128i b = hex_nibbles_sse2(_mm_loadu_si128((const __m128i *)(src + 2 * i + 16)), &ok);
+        _mm_storeu_si128((__m128i *)(dst + i),
+                         _mm_packus_epi16(hex_pairs_sse2(a), hex_pairs_sse2(b)));
+    }
+    if (hex_decode_scalar(dst + i, src + 2 * i, n - i) < 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_nibbles_avx2(__m256i c, int *ok) {
+    __m256i l = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+    __m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+    __m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(l, _mm256_set1_epi8('a' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), l));
+
+    if (_mm256_movemask_epi8(_mm256_or_si256(digit, alpha)) != -1)
+        *ok = 0;
+    return _mm256_sub_epi8(_mm256_sub_epi8(l, _mm256_set1_epi8('0')),
+                           _mm256_and_si256(alpha, _mm256_set1_epi8('a' - '0' - 10)));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i hex_pairs_avx2(__m256i v) {
+    return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x00FF)), 4),
+                           _mm256_srli_epi16(v, 8));
+}
+
+__attribute__((target("avx2")))
+static inline int hex_decode_avx2(unsigned char *dst, const char *src, size_t n) {
+    int ok = 1;
+    size_t i = 0;
+
+    // 64 digits -> 32 bytes per step; the pack works per 128-bit half,
+    // so the quarters are put back in order afterwards
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), &ok);
+        __m256i b = hex_nibbles_avx2(_mm256_loadu_si256((const __m256i *)(src + 2 * i + 32)), &ok);
+        __m256i packed = _mm256_packus_epi16(hex_pairs_avx2(a), hex_pairs_avx2(b));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+    if (hex_decode_sse2(dst + i, src + 2 * i, n - i) < 0)
+        ok = 0;
+    return ok ? 0 : -1;
+}
+
+#endif
+
+static int (*hex_decode_impl)(unsigned char *, const char *, size_t);
+static const char *hex_decode_kernel = "scalar";
+
+// Pick the kernel for this CPU (or the one named by $HEXDEC)
+static inline void hex_decode_select(void) {
+    const char *force = getenv("HEXDEC");
+
+    hex_decode_impl = hex_decode_scalar;
+    hex_decode_kernel = "scalar";
+#ifdef HEXDEC_X86
+    __builtin_cpu_init();
+    if (force != NULL && strcmp(force, "scalar") == 0)
+        return;
+    if (__builtin_cpu_supports("avx2") && (force == NULL || strcmp(force, "avx2") == 0)) {
+        hex_decode_impl = hex_decode_avx2;
+        hex_decode_kernel = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        hex_decode_impl = hex_decode_sse2;
+        hex_decode_kernel = "sse2";
+    }
+#else
+    (void)force;
+#endif
+}
+
+// Decode 2 * n hex digits at src into n bytes at dst
+// Returns 0, or -1 if a character is not a hex digit (dst is then
+// partly written)
+static inline int hex_decode(unsigned char *dst, const char *src, size_t n) {
+    if (hex_decode_impl == NULL)
+        hex_decode_select();
+    return hex_decode_impl(dst, src, n);
+}
+
+#endif
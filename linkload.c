@@ -0,0 +1,377 @@
+/*
+ * Linking Loader
+ *
+ * Links and loads any number of control sections (from one or more
+ * object files) into one memory image starting at PROGADDR.
+ *
+ *   Pass 1  Assigns each control section its CSADDR and enters the
+ *           section names and D-record symbols into ESTAB
+ *   Pass 2  Decodes the T-records into the image (hexdec.h) and
+ *           applies each M-record with the ESTAB value of its symbol
+ *
+ * ESTAB is the open-addressing hash table of asmtab.h, so both passes
+ * are linear in the total size of the object programs. The link time
+ * of each pass and ESTAB's probe counts are reported at the end.
+ *
+ * Usage: linkload [-a progaddr] [-m] [-b file] objfile...
+ *   objfile  Text object programs, one or more H...E sections each
+ *            (default objectcode.txt)
+ *   -a A     Load at hex address A (default 0)
+ *   -m       Print the load map (sections, symbols, addresses)
+ *   -b F     Write the raw memory image to F instead of the hex dump
+ *
+ * Records: H^name^start^length  D^name^addr...  R^name...
+ *          T^addr^len^hex...    M^addr^halfbytes^+name  E[^addr]
+ * An M-record without a symbol relocates by its own section's CSADDR.
+ * R-records may number their names ("R^02LISTB ^03ENDB"); M-records
+ * then say "+02" and the name is looked up once per section, not once
+ * per M-record. 01 is the section itself.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "asmtab.h"
+#include "hexdec.h"
+#include "loadutil.h"
+
+struct ObjFile {
+    const char *name;
+    char *buf;
+    long size;
+};
+
+// A control section: its ESTAB entry and where it was placed
+struct Section {
+    int sym;
+    int start;           // Start address in its H-record
+    int addr, length;    // CSADDR and length
+};
+
+struct Linker {
+    struct ObjFile *files;
+    int nfiles;
+    struct HashTab estab;
+    struct Section *sections;
+    int nsections, sections_cap;
+    int progaddr, total, execaddr;
+    int refs[256];       // Reference number -> address, -1 = none
+    unsigned char *image;
+    long mrecords;
+    int errors;
+};
+
+double now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Next '^'-separated field of a record, without trailing blanks
+// Returns its length
+int next_field(const char **p, const char *eol, const char **f)
+{
+    const char *s = *p, *e;
+
+    *f = s;
+    while (s < eol && *s != '^')
+        s++;
+    *p = s < eol ? s + 1 : s;
+    for (e = s; e > *f && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r'); e--)
+        ;
+    return e - *f;
+}
+
+// Next field as a hex number, or -1
+int next_hex_field(const char **p, const char *eol)
+{
+    const char *f;
+    int len = next_field(p, eol, &f);
+
+    return len > 0 && len <= 7 ? hex_field(f, len) : -1;
+}
+
+void link_error(struct Linker *lk, const struct ObjFile *f, int line_no, const char *msg,
+                const char *name, int len)
+{
+    if (name != NULL)
+        printf("Error: %s:%d: %s %.*s\n", f->name, line_no, msg, len, name);
+    else
+        printf("Error: %s:%d: %s\n", f->name, line_no, msg);
+    lk->errors++;
+}
+
+// Pass 1: H-records get their CSADDR, H and D names go into ESTAB
+void link_pass1(struct Linker *lk)
+{
+    int csaddr = lk->progaddr;
+
+    for (int i = 0; i < lk->nfiles; i++) {
+        const struct ObjFile *f = &lk->files[i];
+        struct Section *cs = NULL;
+        int line_no = 0;
+
+        for (const char *p = f->buf, *end = f->buf + f->size; p < end;) {
+            const char *eol = memchr(p, '\n', end - p), *name;
+            const char *q = p[1] == '^' ? p + 2 : p + 1;
+            const char *next = eol ? eol + 1 : end;
+            int len;
+
+            if (eol == NULL)
+                eol = end;
+            line_no++;
+
+            if (p[0] == 'H') {
+                len = next_field(&q, eol, &name);
+                if (lk->nsections == lk->sections_cap) {
+                    lk->sections_cap = lk->sections_cap ? lk->sections_cap * 2 : 64;
+                    lk->sections = realloc(lk->sections,
+                                           lk->sections_cap * sizeof(struct Section));
+                }
+                cs = &lk->sections[lk->nsections++];
+                cs->addr = csaddr;
+                cs->start = next_hex_field(&q, eol);
+                cs->length = next_hex_field(&q, eol);
+                if (len == 0 || cs->start < 0 || cs->length < 0) {
+                    link_error(lk, f, line_no, "Bad H record", NULL, 0);
+                    cs->start = cs->length = 0;
+                }
+                if ((cs->sym = tab_add(&lk->estab, name, len, csaddr)) < 0)
+                    link_error(lk, f, line_no, "Duplicate external symbol", name, len);
+                csaddr += cs->length;
+            } else if (p[0] == 'D' && cs != NULL) {
+                while ((len = next_field(&q, eol, &name)) > 0) {
+                    int addr = next_hex_field(&q, eol);
+                    if (addr < 0)
+                        link_error(lk, f, line_no, "Bad address for", name, len);
+                    else if (tab_add(&lk->estab, name, len, cs->addr + addr - cs->start) < 0)
+                        link_error(lk, f, line_no, "Duplicate external symbol", name, len);
+                }
+            } else if (p[0] == 'E') {
+                cs = NULL;
+            }
+            p = next;
+        }
+    }
+    lk->total = csaddr - lk->progaddr;
+}
+
+// Decode the hex fields of a T-record into the image at image offset 'off'
+// 'limit' is the end of the control section in the image
+// Returns the number of bytes loaded, or -1 if the record is malformed
+int load_trecord(struct Linker *lk, const char *q, const char *eol, int off, int limit)
+{
+    const char *f;
+    int len, first = off;
+
+    while (q < eol) {
+        len = next_field(&q, eol, &f);
+        if (len > 0 && f[len - 1] == '$') {
+            len--;   // End of the record
+            q = eol;
+        }
+        if (len % 2 != 0 || off < 0 || off + len / 2 > limit ||
+            hex_decode(lk->image + off, f, len / 2) < 0)
+            return -1;
+        off += len / 2;
+    }
+    return off - first;
+}
+
+// Address of an external symbol for an M-record: "NN" is a reference
+// number of the section's R-record, anything else a name
+// Returns -1 if it is undefined
+int resolve_symbol(struct Linker *lk, const char *name, int len)
+{
+    int sym;
+
+    if (len == 2 && name[0] >= '0' && name[0] <= '9')
+        return (sym = hex_field(name, 2)) >= 0 ? lk->refs[sym] : -1;
+    sym = tab_find(&lk->estab, name, len);
+    return sym >= 0 ? lk->estab.entries[sym].value : -1;
+}
+
+// Pass 2: load the T-records and resolve the M-records through ESTAB
+void link_pass2(struct Linker *lk)
+{
+    int k = 0;
+
+    lk->image = calloc(lk->total + 1, 1);
+    lk->execaddr = -1;
+    for (int i = 0; i < lk->nfiles; i++) {
+        const struct ObjFile *f = &lk->files[i];
+        const struct Section *cs = NULL;
+        int line_no = 0;
+
+        for (const char *p = f->buf, *end = f->buf + f->size; p < end;) {
+            const char *eol = memchr(p, '\n', end - p), *name;
+            const char *q = p[1] == '^' ? p + 2 : p + 1;
+            const char *next = eol ? eol + 1 : end;
+            int len;
+
+            if (eol == NULL)
+                eol = end;
+            line_no++;
+
+            if (p[0] == 'H') {
+                cs = &lk->sections[k++];
+                memset(lk->refs, -1, sizeof(lk->refs));
+                lk->refs[1] = cs->addr;
+            } else if (p[0] == 'R' && cs != NULL) {
+                // Resolve numbered references now, once for the section
+                while ((len = next_field(&q, eol, &name)) > 0) {
+                    int n = len > 2 && name[0] >= '0' && name[0] <= '9' ? hex_field(name, 2) : -1;
+                    if (n >= 0 && (lk->refs[n] = resolve_symbol(lk, name + 2, len - 2)) < 0)
+                        link_error(lk, f, line_no, "Undefined external symbol", name + 2,
+                                   len - 2);
+                }
+            } else if (p[0] == 'T' && cs != NULL) {
+                int addr = next_hex_field(&q, eol);
+                int count = next_hex_field(&q, eol);
+                int base = cs->addr - lk->progaddr - cs->start, loaded = -1;
+
+                if (addr >= 0 && count >= 0)
+                    loaded = load_trecord(lk, q, eol, base + addr, base + cs->start + cs->length);
+                if (loaded < 0)
+                    link_error(lk, f, line_no, "Bad T record", NULL, 0);
+                else if (loaded != count)
+                    link_error(lk, f, line_no, "T record length does not match", NULL, 0);
+            } else if (p[0] == 'M' && cs != NULL) {
+                int addr = next_hex_field(&q, eol);
+                int halfbytes = next_hex_field(&q, eol);
+                int off = cs->addr - lk->progaddr + addr - cs->start;
+                int delta = cs->addr - cs->start;
+
+                lk->mrecords++;
+                len = next_field(&q, eol, &name);
+                if (addr < 0 || halfbytes < 1 || halfbytes > 8 || off < 0 ||
+                    off + (halfbytes + 1) / 2 > lk->total) {
+                    link_error(lk, f, line_no, "Bad M record", NULL, 0);
+                } else if (len > 1 && (name[0] == '+' || name[0] == '-')) {
+                    if ((delta = resolve_symbol(lk, name + 1, len - 1)) < 0)
+                        link_error(lk, f, line_no, "Undefined external symbol", name + 1,
+                                   len - 1);
+                    else
+                        patch_field(lk->image + off, halfbytes, name[0] == '-' ? -delta : delta);
+                } else {
+                    patch_field(lk->image + off, halfbytes, delta);
+                }
+            } else if (p[0] == 'E' && cs != NULL) {
+                // The first section naming an entry point supplies EXECADDR
+                int addr = next_hex_field(&q, eol);
+                if (addr >= 0 && lk->execaddr < 0)
+                    lk->execaddr = cs->addr + addr - cs->start;
+                cs = NULL;
+            }
+            p = next;
+        }
+    }
+    if (lk->execaddr < 0)
+        lk->execaddr = lk->progaddr;
+}
+
+void write_load_map(const struct Linker *lk, FILE *fp)
+{
+    const struct HashTab *t = &lk->estab;
+    int k = 0;
+
+    fprintf(fp, "Control   Symbol\n");
+    fprintf(fp, "section   name      Address   Length\n");
+    fprintf(fp, "------------------------------------\n");
+    for (int i = 0; i < t->count; i++) {
+        if (k < lk->nsections && lk->sections[k].sym == i) {
+            fprintf(fp, "%-6s              %06X    %06X\n", t->entries[i].name,
+                    lk->sections[k].addr, lk->sections[k].length);
+            k++;
+        } else
+            fprintf(fp, "          %-6s    %06X\n", t->entries[i].name, t->entries[i].value);
+    }
+    fprintf(fp, "------------------------------------\n");
+}
+
+int main(int argc, char *argv[])
+{
+    static const char *default_file = "objectcode.txt";
+    const char *image_file = NULL;
+    struct Linker lk;
+    long bytes = 0;
+    int map = 0, status = 0;
+    double t0, t1, t2;
+
+    memset(&lk, 0, sizeof(lk));
+    lk.files = calloc(argc, sizeof(struct ObjFile));
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+            lk.progaddr = strtol(argv[++i], NULL, 16);
+        } else if (strcmp(argv[i], "-m") == 0) {
+            map = 1;
+        } else if (strcmp(argv[i], "-b") == 0 && i + 1 < argc) {
+            image_file = argv[++i];
+        } else if (argv[i][0] == '-') {
+            printf("Usage: %s [-a progaddr] [-m] [-b file] objfile...\n", argv[0]);
+            return 1;
+        } else {
+            lk.files[lk.nfiles++].name = argv[i];
+        }
+    }
+    if (lk.nfiles == 0)
+        lk.files[lk.nfiles++].name = default_file;
+
+    for (int i = 0; i < lk.nfiles; i++) {
+        if ((lk.files[i].size = read_file(lk.files[i].name, &lk.files[i].buf)) < 0) {
+            printf("Error: Cannot open %s\n", lk.files[i].name);
+            return 1;
+        }
+        bytes += lk.files[i].size;
+    }
+    tab_init(&lk.estab, 1024);
+
+    t0 = now_ms();
+    link_pass1(&lk);
+    t1 = now_ms();
+    if (lk.errors == 0)
+        link_pass2(&lk);
+    t2 = now_ms();
+
+    if (lk.errors == 0) {
+        if (map)
+            write_load_map(&lk, stdout);
+        printf("Loaded %d bytes at %06X, entry %06X\n", lk.total, lk.progaddr, lk.execaddr);
+        fflush(stdout);
+        if (image_file != NULL) {
+            FILE *fp = fopen(image_file, "wb");
+            if (fp == NULL || fwrite(lk.image, 1, lk.total, fp) != (size_t)lk.total) {
+                printf("Error: Cannot write %s\n", image_file);
+                status = 1;
+            }
+            if (fp)
+                fclose(fp);
+        } else {
+            write_hex_dump(lk.image, lk.progaddr, lk.total, stdout);
+        }
+    }
+
+    printf("\nLinked %d control section(s) from %d file(s), %ld bytes of object code\n",
+           lk.nsections, lk.nfiles, bytes);
+    printf("Link time: pass 1 %.3f ms, pass 2 %.3f ms\n", t1 - t0, t2 - t1);
+    printf("ESTAB: %d symbols in %d slots, %ld lookups, %.3f probes per lookup"
+           " (%ld M-records)\n", lk.estab.count, lk.estab.nslots, lk.estab.lookups,
+           lk.estab.lookups ? (double)lk.estab.probes / lk.estab.lookups : 0.0, lk.mrecords);
+    if (lk.errors > 0) {
+        printf("%d error(s), nothing loaded\n", lk.errors);
+        status = 1;
+    }
+
+    for (int i = 0; i < lk.nfiles; i++)
+        free(lk.files[i].buf);
+    free(lk.files);
+    free(lk.sections);
+    free(lk.image);
+    tab_free(&lk.estab);
+    return status;
+}
@@ -0,0 +1,75 @@
+/*
+ * Helpers shared by the loaders (absloader.c, reloc.c, linkload.c)
+ *
+ * read_file() reads an object program in one call, patch_field()
+ * relocates an address field of any width inside the memory image and
+ * write_hex_dump() prints the loaded image.
+ */
+
+#ifndef LOADUTIL_H
+#define LOADUTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define DUMP_BYTES 16    // Bytes per line of the hex dump
+
+// Read a whole file into memory (NUL-terminated); returns its size or -1
+static inline long read_file(const char *filename, char **buf) {
+    FILE *fp = fopen(filename, "rb");
+    long size;
+
+    if (fp == NULL)
+        return -1;
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+    *buf = malloc(size + 1);
+    if (fread(*buf, 1, size, fp) != (size_t)size) {
+        free(*buf);
+        fclose(fp);
+        return -1;
+    }
+    (*buf)[size] = '\0';
+    fclose(fp);
+    return size;
+}
+
+// Add 'delta' to the field of 'halfbytes' nibbles (1-8) right-aligned
+// in the (halfbytes + 1) / 2 bytes at p; the nibbles around it are kept
+static inline void patch_field(unsigned char *p, int halfbytes, int delta) {
+    int nbytes = (halfbytes + 1) / 2;
+    uint64_t v = 0, mask = (1ULL << (4 * halfbytes)) - 1;
+
+    for (int i = 0; i < nbytes; i++)
+        v = v << 8 | p[i];
+    v = (v & ~mask) | ((v + (int64_t)delta) & mask);
+    for (int i = nbytes - 1; i >= 0; i--, v >>= 8)
+        p[i] = v & 0xFF;
+}
+
+// Write 'length' image bytes loaded at 'start' as "ADDRESS  hex bytes"
+// lines, with one fwrite
+static inline void write_hex_dump(const unsigned char *image, int start, int length, FILE *fp) {
+    static const char hexdig[] = "0123456789ABCDEF";
+    int lines = (length + DUMP_BYTES - 1) / DUMP_BYTES;
+    char *out = malloc((size_t)lines * (8 + 3 * DUMP_BYTES + 1) + 1);
+    char *q = out;
+
+    for (int off = 0; off < length; off += DUMP_BYTES) {
+        int n = length - off < DUMP_BYTES ? length - off : DUMP_BYTES;
+        q += sprintf(q, "%06X ", start + off);
+        for (int i = 0; i < n; i++) {
+            if (i % 4 == 0)
+                *q++ = ' ';
+            *q++ = hexdig[image[off + i] >> 4];
+            *q++ = hexdig[image[off + i] & 15];
+        }
+        *q++ = '\n';
+    }
+    fwrite(out, 1, q - out, fp);
+    free(out);
+}
+
+#endif
@@ -0,0 +1,995 @@
+/*
+ * In-memory NAMTAB and DEFTAB for the macro processor
+ *
+ * NAMTAB is a hash table (asmtab.h) from macro name to the macro's
+ * index. Every macro owns a contiguous range of DEFTAB, an array of
+ * body lines, so expanding a call costs one lookup plus a linear walk
+ * over its range; nothing is re-read from disk. The classic
+ * namtab.txt / deftab.txt files can still be written from the tables
+ * on request.
+ *
+ * Bodies are compiled when the macro is defined: every field of a body
+ * line becomes a list of pieces, each either literal text or the slot
+ * of a formal parameter, so "BUF+&OFF" is the text "BUF+" followed by
+ * slot 1. Expansion concatenates the pieces from the argument array of
+ * the call; no string is searched at expansion time.
+ *
+ * Formal parameters: "&A,&B,&MODE=X" (any number; '=' gives a keyword
+ * parameter with its default). A call passes positional arguments
+ * first, then keyword ones: "ALPHA,BETA,MODE=Y".
+ *
+ * Conditional expansion: IF cond / ELSE / ENDIF and WHILE cond / ENDW
+ * in a body, with "&V SET expr" for local variables (initially 0).
+ * A condition is "A op B" with op one of = != < <= > >= (numeric when
+ * both sides are integer expressions, else a string comparison), or a
+ * lone value that is true unless empty or 0; parentheses are optional.
+ * These lines are compiled when the macro is defined: each condition
+ * is split into two compiled fields, IF/WHILE become conditional jumps
+ * and ELSE/ENDW plain jumps with their targets filled in (ENDIF leaves
+ * no line at all), so an expansion runs the body as a small
+ * interpreter and never parses the control lines again.
+ *
+ * The processor runs as a stream (struct MacroStream) over a Lexer:
+ * every mac_stream_next() returns the next (label, opcode, operand)
+ * record of the expanded program. Definitions are consumed, calls are
+ * replaced by their bodies and all other lines pass through untouched,
+ * so pass 1 of the assembler can read the stream directly (see
+ * struct LineSource in asmcore.h) with no expanded file in between.
+ * A call expands into a block of text that is kept in an LRU cache
+ * (macrocache.h) under its macro and argument values; the same call
+ * again is served from the block without expanding anything.
+ *
+ * Expansions are read through an explicit stack of frames, each the
+ * substituted text of one call plus a read position. Their lines are
+ * scanned like source lines, so a body may call other macros (or
+ * itself, up to max_depth levels) and may contain MACRO...MEND pairs
+ * that define new macros when it is expanded; expanding it again
+ * replaces those definitions. Every line is scanned once per level it
+ * passes through.
+ */
+
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+
+#include "asmtab.h"
+#include "asmlex.h"
+#include "macrocache.h"
+
+#define MAC_FIELD_MAX 512
+
+// Literal text, or a formal parameter
+struct MacroPiece {
+    int slot;        // Parameter slot, or -1 for text
+    int text, len;   // Text in the pool (slot < 0)
+};
+
+// A compiled field: pieces [first, first + n)
+struct MacroField {
+    int first, n;
+};
+
+// DEFTAB line kinds
+#define MAC_TEXT 0   // Copy the line into the expansion
+#define MAC_IF   1   // Go to 'target' unless condition 'arg' holds (IF, WHILE)
+#define MAC_JUMP 2   // Go to 'target' (ELSE, ENDW)
+#define MAC_SET  3   // Set slot 'arg' to the value of the operand
+#define MAC_END  4   // End of the body (never stored)
+
+// Comparisons of a condition
+#define MAC_REL_TRUE 0   // Lone value: not empty and not 0
+#define MAC_REL_EQ   1
+#define MAC_REL_NE   2
+#define MAC_REL_LT   3
+#define MAC_REL_LE   4
+#define MAC_REL_GT   5
+#define MAC_REL_GE   6
+
+#define MAC_MAX_STEPS 1000000 // Conditions evaluated per expansion (WHILE guard)
+
+// One body line: label, opcode and operand
+struct MacroLine {
+    struct MacroField f[3];
+    int op;          // MAC_TEXT, MAC_IF, ...
+    int target;      // Jump target in DEFTAB (MAC_IF, MAC_JUMP)
+    int arg;         // Condition (MAC_IF) or slot (MAC_SET)
+};
+
+struct MacroCond {
+    struct MacroField lhs, rhs;
+    int rel;
+};
+
+// An IF, ELSE or WHILE still open while a body is compiled
+struct MacroBlock {
+    int line;        // Its DEFTAB line
+    int type;        // MAC_BLOCK_IF, ...
+};
+
+#define MAC_BLOCK_IF    0
+#define MAC_BLOCK_ELSE  1
+#define MAC_BLOCK_WHILE 2
+
+struct MacroParam {
+    int name, len;   // Name without the '&'
+    int def;         // Default value (keyword parameters), or -1
+};
+
+struct Macro {
+    int name;        // Offset of the name in the text pool
+    int first_param, nparams;
+    int nlocals;     // The last nlocals slots are SET variables
+    int first, last; // DEFTAB range [first, last) of the body
+    int replaced;    // Superseded by a later definition of the name
+};
+
+struct MacroTab {
+    struct HashTab namtab;     // Name -> index in macros[]
+    struct Macro *macros;
+    int nmacros, macros_cap;
+    struct MacroLine *deftab;
+    int ndef, def_cap;
+    struct MacroPiece *pieces;
+    int npieces, pieces_cap;
+    struct MacroParam *params;
+    int nparams, params_cap;
+    char *text;                // Names, defaults and literal pieces
+    int text_len, text_cap;
+    struct MacroCond *conds;
+    int nconds, conds_cap;
+    struct MacroBlock *open;   // Open blocks of the body being compiled
+    int nopen, open_cap;
+};
+
+// Argument values of one call, indexed by parameter slot
+struct MacroArgs {
+    char *buf;       // Values, NUL-terminated
+    int len, cap;
+    int *val;        // Offset of each slot's value in buf
+    int n, slots_cap;
+};
+
+#define MAC_GROW(ptr, count, cap, init)                                  \
+    do {                                                                 \
+        if ((count) == (cap)) {                                          \
+            (cap) = (cap) ? (cap) * 2 : (init);                          \
+            (ptr) = realloc((ptr), (cap) * sizeof(*(ptr)));              \
+        }                                                                \
+    } while (0)
+
+static inline void mac_init(struct MacroTab *mt) {
+    memset(mt, 0, sizeof(*mt));
+    tab_init(&mt->namtab, 64);
+}
+
+static inline void mac_free(struct MacroTab *mt) {
+    tab_free(&mt->namtab);
+    free(mt->macros);
+    free(mt->deftab);
+    free(mt->pieces);
+    free(mt->params);
+    free(mt->text);
+    free(mt->conds);
+    free(mt->open);
+    memset(mt, 0, sizeof(*mt));
+}
+
+// Copy 'len' bytes (plus a NUL) into the text pool and return the offset
+static inline int mac_push_text(struct MacroTab *mt, const char *s, int len) {
+    int off = mt->text_len;
+
+    while (mt->text_len + len + 1 > mt->text_cap) {
+        mt->text_cap = mt->text_cap ? mt->text_cap * 2 : 4096;
+        mt->text = realloc(mt->text, mt->text_cap);
+    }
+    memcpy(mt->text + off, s, len);
+    mt->text[off + len] = '\0';
+    mt->text_len += len + 1;
+    return off;
+}
+
+static inline int mac_is_name_char(char c) {
+    return (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Length of the next comma-separated item; quotes (C'A,B') are kept whole
+static inline int mac_item_len(const char *s) {
+    int i = 0, quoted = 0;
+    for (; s[i] && (quoted || s[i] != ','); i++)
+        if (s[i] == '\'')
+            quoted = !quoted;
+    return i;
+}
+
+// Start the definition of a macro from its formal parameter list; the
+// body lines follow with mac_add_line() and mac_end() closes it
+// An existing name is an error unless 'replace' is set, in which case the
+// new definition takes the name over
+// Returns the macro index, or -1 if the name is already defined
+static inline int mac_begin(struct MacroTab *mt, const char *name, const char *params,
+                            int replace) {
+    int id = tab_find(&mt->namtab, name, strlen(name));
+
+    if (id >= 0 && !replace)
+        return -1;
+    if (id >= 0) {
+        // The old body stays in DEFTAB but the name now maps to the new one
+        mt->macros[mt->namtab.entries[id].value].replaced = 1;
+        mt->namtab.entries[id].value = mt->nmacros;
+    } else {
+        tab_add(&mt->namtab, name, strlen(name), mt->nmacros);
+    }
+    MAC_GROW(mt->macros, mt->nmacros, mt->macros_cap, 16);
+    struct Macro *m = &mt->macros[mt->nmacros];
+    m->name = mac_push_text(mt, name, strlen(name));
+    m->replaced = 0;
+    m->first_param = mt->nparams;
+    m->nparams = 0;
+    m->nlocals = 0;
+    m->first = m->last = mt->ndef;
+    mt->nopen = 0;
+
+    // "&A,&B,&MODE=X"; "-" means no parameters
+    for (const char *p = params; *p && strcmp(params, "-") != 0;) {
+        int len = mac_item_len(p);
+        const char *eq = memchr(p, '=', len);
+        const char *nm = p[0] == '&' ? p + 1 : p;
+        int nlen = (eq ? eq : p + len) - nm;
+
+        MAC_GROW(mt->params, mt->nparams, mt->params_cap, 32);
+        struct MacroParam *pr = &mt->params[mt->nparams++];
+        pr->name = mac_push_text(mt, nm, nlen);
+        pr->len = nlen;
+        pr->def = eq ? mac_push_text(mt, eq + 1, p + len - eq - 1) : -1;
+        m->nparams++;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return mt->nmacros++;
+}
+
+static inline void mac_add_piece(struct MacroTab *mt, int slot, const char *s, int len) {
+    MAC_GROW(mt->pieces, mt->npieces, mt->pieces_cap, 256);
+    struct MacroPiece *pc = &mt->pieces[mt->npieces++];
+    pc->slot = slot;
+    pc->text = slot < 0 ? mac_push_text(mt, s, len) : 0;
+    pc->len = len;
+}
+
+// Compile one field against the parameters of macro 'm'
+// "&NAME" becomes a slot reference (longest matching name wins); all
+// other text is kept as literal pieces
+static inline struct MacroField mac_compile_field(struct MacroTab *mt, const struct Macro *m,
+                                                  const char *s) {
+    struct MacroField f = { mt->npieces, 0 };
+    const char *lit = s;
+
+    while (*s) {
+        int slot = -1, best = 0;
+        if (*s == '&') {
+            for (int k = 0; k < m->nparams; k++) {
+                const struct MacroParam *pr = &mt->params[m->first_param + k];
+                if (pr->len > best && strncmp(s + 1, mt->text + pr->name, pr->len) == 0) {
+                    slot = k;
+                    best = pr->len;
+                }
+            }
+        }
+        if (slot < 0) {
+            s++;
+            continue;
+        }
+        if (s > lit)
+            mac_add_piece(mt, -1, lit, s - lit);
+        mac_add_piece(mt, slot, NULL, 0);
+        s += 1 + best;
+        lit = s;
+    }
+    if (s > lit || f.first == mt->npieces)
+        mac_add_piece(mt, -1, lit, s - lit);
+    f.n = mt->npieces - f.first;
+    return f;
+}
+
+// Append a body line to the macro being defined, as text to copy
+// Returns its DEFTAB index
+static inline int mac_add_text(struct MacroTab *mt, const char *label, const char *opcode,
+                               const char *operand) {
+    const struct Macro *m = &mt->macros[mt->nmacros - 1];
+    struct MacroLine ln;
+
+    ln.f[0] = mac_compile_field(mt, m, label);
+    ln.f[1] = mac_compile_field(mt, m, opcode);
+    ln.f[2] = mac_compile_field(mt, m, operand);
+    ln.op = MAC_TEXT;
+    ln.target = -1;
+    ln.arg = -1;
+    MAC_GROW(mt->deftab, mt->ndef, mt->def_cap, 256);
+    mt->deftab[mt->ndef] = ln;
+    return mt->ndef++;
+}
+
+// Slot of the SET variable "&NAME" of the macro being defined; a name
+// that is not a parameter yet becomes a new local slot, initially 0
+static inline int mac_local_slot(struct MacroTab *mt, const char *name) {
+    struct Macro *m = &mt->macros[mt->nmacros - 1];
+    int len = strlen(name + 1);
+
+    for (int k = 0; k < m->nparams; k++) {
+        const struct MacroParam *pr = &mt->params[m->first_param + k];
+        if (pr->len == len && strcmp(mt->text + pr->name, name + 1) == 0)
+            return k;
+    }
+    MAC_GROW(mt->params, mt->nparams, mt->params_cap, 32);
+    struct MacroParam *pr = &mt->params[mt->nparams++];
+    pr->name = mac_push_text(mt, name + 1, len);
+    pr->len = len;
+    pr->def = mac_push_text(mt, "0", 1);
+    m->nlocals++;
+    return m->nparams++;
+}
+
+// Compile a condition "A op B" (or a lone "A"), optionally in parentheses
+// Returns its index in conds[]
+static inline int mac_compile_cond(struct MacroTab *mt, const char *text) {
+    static const char *rels[] = { "!=", "<=", ">=", "<>", "=", "<", ">" };
+    static const int rel_ids[] = { MAC_REL_NE, MAC_REL_LE, MAC_REL_GE, MAC_REL_NE,
+                                   MAC_REL_EQ, MAC_REL_LT, MAC_REL_GT };
+    const struct Macro *m = &mt->macros[mt->nmacros - 1];
+    char buf[MAC_FIELD_MAX];
+    int len = strlen(text), at = -1, r = 0, quoted = 0;
+
+    if (len >= 2 && text[0] == '(' && text[len - 1] == ')') {
+        text++;
+        len -= 2;
+    }
+    if (len > MAC_FIELD_MAX - 1)
+        len = MAC_FIELD_MAX - 1;
+    memcpy(buf, text, len);
+    buf[len] = '\0';
+
+    // The first comparison operator outside quotes splits the sides
+    for (int i = 0; buf[i] && at < 0; i++) {
+        if (buf[i] == '\'')
+            quoted = !quoted;
+        for (r = 0; !quoted && r < 7 && at < 0; r++)
+            if (strncmp(buf + i, rels[r], strlen(rels[r])) == 0)
+                at = i;
+    }
+
+    MAC_GROW(mt->conds, mt->nconds, mt->conds_cap, 32);
+    struct MacroCond *c = &mt->conds[mt->nconds];
+    if (at < 0) {
+        c->rel = MAC_REL_TRUE;
+        c->lhs = mac_compile_field(mt, m, buf);
+        c->rhs = c->lhs;
+    } else {
+        r--;
+        c->rel = rel_ids[r];
+        c->rhs = mac_compile_field(mt, m, buf + at + strlen(rels[r]));
+        buf[at] = '\0';
+        c->lhs = mac_compile_field(mt, m, buf);
+    }
+    return mt->nconds++;
+}
+
+static inline void mac_open_block(struct MacroTab *mt, int line, int type) {
+    MAC_GROW(mt->open, mt->nopen, mt->open_cap, 8);
+    mt->open[mt->nopen].line = line;
+    mt->open[mt->nopen++].type = type;
+}
+
+// Append a body line to the macro being defined, compiling IF, ELSE,
+// ENDIF, WHILE, ENDW and SET into jumps and assignments
+// Returns 0, or -1 if the line does not fit the open blocks (or a SET
+// has no "&NAME" label)
+static inline int mac_add_line(struct MacroTab *mt, const char *label, const char *opcode,
+                               const char *operand) {
+    struct MacroBlock *top = mt->nopen ? &mt->open[mt->nopen - 1] : NULL;
+    int i;
+
+    if (strcmp(opcode, "IF") == 0 || strcmp(opcode, "WHILE") == 0) {
+        i = mac_add_text(mt, label, opcode, operand);
+        mt->deftab[i].op = MAC_IF;
+        mt->deftab[i].arg = mac_compile_cond(mt, operand);
+        mac_open_block(mt, i, opcode[0] == 'I' ? MAC_BLOCK_IF : MAC_BLOCK_WHILE);
+    } else if (strcmp(opcode, "ELSE") == 0) {
+        if (top == NULL || top->type != MAC_BLOCK_IF)
+            return -1;
+        i = mac_add_text(mt, label, opcode, operand);
+        mt->deftab[i].op = MAC_JUMP;
+        mt->deftab[top->line].target = mt->ndef;
+        top->line = i;
+        top->type = MAC_BLOCK_ELSE;
+    } else if (strcmp(opcode, "ENDIF") == 0) {
+        if (top == NULL || top->type == MAC_BLOCK_WHILE)
+            return -1;
+        mt->deftab[top->line].target = mt->ndef;
+        mt->nopen--;
+    } else if (strcmp(opcode, "ENDW") == 0) {
+        if (top == NULL || top->type != MAC_BLOCK_WHILE)
+            return -1;
+        i = mac_add_text(mt, label, opcode, operand);
+        mt->deftab[i].op = MAC_JUMP;
+        mt->deftab[i].target = top->line;
+        mt->deftab[top->line].target = mt->ndef;
+        mt->nopen--;
+    } else if (strcmp(opcode, "SET") == 0) {
+        if (label[0] != '&' || label[1] == '\0')
+            return -1;
+        int slot = mac_local_slot(mt, label);
+        i = mac_add_text(mt, label, opcode, operand);
+        mt->deftab[i].op = MAC_SET;
+        mt->deftab[i].arg = slot;
+    } else {
+        mac_add_text(mt, label, opcode, operand);
+    }
+    return 0;
+}
+
+// Close the macro being defined
+// Jumps that land on another jump are threaded to its target, so every
+// jump is taken once at expansion time
+// Returns 0, or -1 if an IF or WHILE is left open
+static inline int mac_end(struct MacroTab *mt) {
+    struct Macro *m = &mt->macros[mt->nmacros - 1];
+
+    m->last = mt->ndef;
+    for (int k = m->first; k < m->last; k++) {
+        struct MacroLine *ln = &mt->deftab[k];
+        if (ln->op != MAC_IF && ln->op != MAC_JUMP)
+            continue;
+        if (ln->target < 0)
+            ln->target = m->last; // Left open: jump to the end
+        for (int hops = 0; ln->target < m->last && mt->deftab[ln->target].op == MAC_JUMP &&
+                           mt->deftab[ln->target].target >= 0 && hops < m->last - m->first;
+             hops++)
+            ln->target = mt->deftab[ln->target].target;
+    }
+    return mt->nopen ? -1 : 0;
+}
+
+// Index of a macro, or -1 if 'name' is not a macro
+static inline int mac_find(struct MacroTab *mt, struct StrView name) {
+    int id = tab_find(&mt->namtab, name.p, name.len);
+    return id < 0 ? -1 : mt->namtab.entries[id].value;
+}
+
+static inline void mac_args_free(struct MacroArgs *a) {
+    free(a->buf);
+    free(a->val);
+    memset(a, 0, sizeof(*a));
+}
+
+static inline int mac_args_push(struct MacroArgs *a, const char *s, int len) {
+    int off = a->len;
+    while (a->len + len + 1 > a->cap) {
+        a->cap = a->cap ? a->cap * 2 : 256;
+        a->buf = realloc(a->buf, a->cap);
+    }
+    memcpy(a->buf + off, s, len);
+    a->buf[off + len] = '\0';
+    a->len += len + 1;
+    return off;
+}
+
+// Bind the actual arguments of a call ("X,Y,MODE=Z") to the slots of
+// macro 'm'; missing arguments get their default or the empty string
+// Returns 0, or -1 if an argument names no keyword parameter or there
+// are more positional arguments than parameters
+static inline int mac_bind_args(struct MacroTab *mt, int m, const char *actual,
+                                struct MacroArgs *a) {
+    const struct Macro *mac = &mt->macros[m];
+    int pos = 0, status = 0, nformal = mac->nparams - mac->nlocals;
+
+    a->len = 0;
+    a->n = mac->nparams;
+    if (a->n > a->slots_cap) {
+        a->slots_cap = a->n;
+        a->val = realloc(a->val, a->slots_cap * sizeof(int));
+    }
+    for (int k = 0; k < a->n; k++)
+        a->val[k] = -1;
+
+    for (const char *p = actual; *p && strcmp(actual, "-") != 0;) {
+        int len = mac_item_len(p), slot = -1;
+        const char *eq = memchr(p, '=', len);
+        const char *value = p;
+
+        // NAME=value (or &NAME=value) selects a keyword parameter
+        if (eq != NULL && p[0] != '=' && eq[-1] != '\'') {
+            const char *nm = p[0] == '&' ? p + 1 : p;
+            for (int k = 0; k < nformal; k++) {
+                const struct MacroParam *pr = &mt->params[mac->first_param + k];
+                if (pr->len == eq - nm && strncmp(nm, mt->text + pr->name, pr->len) == 0)
+                    slot = k;
+            }
+            value = eq + 1;
+            if (slot < 0)
+                status = -1;
+        } else {
+            slot = pos < nformal ? pos++ : -1;
+            if (slot < 0)
+                status = -1;
+        }
+        if (slot >= 0)
+            a->val[slot] = mac_args_push(a, value, p + len - value);
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+
+    for (int k = 0; k < a->n; k++) {
+        if (a->val[k] < 0) {
+            const struct MacroParam *pr = &mt->params[mac->first_param + k];
+            const char *def = pr->def >= 0 ? mt->text + pr->def : "";
+            a->val[k] = mac_args_push(a, def, strlen(def));
+        }
+    }
+    return status;
+}
+
+// Expand one compiled field into 'out' (always NUL-terminated)
+// Returns the length of the expansion
+static inline int mac_expand_field(const struct MacroTab *mt, struct MacroField f,
+                                   const struct MacroArgs *a, char *out, int size) {
+    int n = 0;
+
+    for (int i = 0; i < f.n; i++) {
+        const struct MacroPiece *pc = &mt->pieces[f.first + i];
+        const char *s = pc->slot < 0 ? mt->text + pc->text : a->buf + a->val[pc->slot];
+        int len = pc->slot < 0 ? pc->len : (int)strlen(s);
+        if (len > size - 1 - n)
+            len = size - 1 - n;
+        memcpy(out + n, s, len);
+        n += len;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+// Write a compiled field, with parameters shown as ?1, ?2, ...
+static inline void mac_dump_field(const struct MacroTab *mt, FILE *fp, struct MacroField f) {
+    for (int i = 0; i < f.n; i++) {
+        const struct MacroPiece *pc = &mt->pieces[f.first + i];
+        if (pc->slot < 0)
+            fputs(mt->text + pc->text, fp);
+        else
+            fprintf(fp, "?%d", pc->slot + 1);
+    }
+}
+
+// Write NAMTAB and DEFTAB in the namtab.txt / deftab.txt formats
+static inline void mac_dump(const struct MacroTab *mt, FILE *f_namtab, FILE *f_deftab) {
+    for (int i = 0; i < mt->nmacros; i++) {
+        const struct Macro *m = &mt->macros[i];
+        if (m->replaced)
+            continue;
+        fprintf(f_namtab, "%s\n", mt->text + m->name);
+        fprintf(f_deftab, "%s\t", mt->text + m->name);
+        for (int k = 0; k < m->nparams - m->nlocals; k++) {
+            const struct MacroParam *pr = &mt->params[m->first_param + k];
+            fprintf(f_deftab, "%s&%s", k ? "," : "", mt->text + pr->name);
+            if (pr->def >= 0)
+                fprintf(f_deftab, "=%s", mt->text + pr->def);
+        }
+        fprintf(f_deftab, "%s\n", m->nparams > m->nlocals ? "" : "-");
+        for (int k = m->first; k < m->last; k++) {
+            mac_dump_field(mt, f_deftab, mt->deftab[k].f[1]);
+            fputc('\t', f_deftab);
+            mac_dump_field(mt, f_deftab, mt->deftab[k].f[2]);
+            fputc('\n', f_deftab);
+        }
+        fprintf(f_deftab, "MEND\n");
+    }
+}
+
+#define MAC_MAX_DEPTH 256
+
+// One level of expansion: the text of a call, already substituted, and
+// the read position in it; its lines are scanned again for calls
+struct MacroFrame {
+    char *buf;        // "label\0opcode\0operand\0" per line
+    int len, cap;
+    int pos;
+};
+
+// The macro processor as a source of expanded lines
+struct MacroStream {
+    struct MacroTab mt;
+    struct Lexer *lx;
+    int (*is_opcode)(struct StrView); // Sorts 2-field lines, see mac_sort_fields()
+    long opcode_lookups; // Calls of is_opcode, for the assembler's --stats
+    int echo_calls;   // Also return each call as a ". NAME args" line
+    int max_depth;    // Nesting limit of calls
+    struct MacroArgs args;
+    struct ExpCache cache;
+    struct MacroFrame *frames; // Expansion stack; buffers are kept for reuse
+    int depth, frames_cap;
+    char *key;        // Cache key of the current call
+    int key_len, key_cap;
+    long calls, lines_out;
+    int max_seen;     // Deepest nesting reached
+    int error_flag;
+    FILE *diag;       // Where errors go (NULL = stdout)
+};
+
+// Report an error (" Error: ..." plus a newline) and flag the stream
+static inline void mac_error(struct MacroStream *ms, const char *fmt, ...) {
+    FILE *fp = ms->diag != NULL ? ms->diag : stdout;
+    va_list ap;
+
+    fputs(" Error: ", fp);
+    va_start(ap, fmt);
+    vfprintf(fp, fmt, ap);
+    va_end(ap);
+    fputc('\n', fp);
+    ms->error_flag = 1;
+}
+
+// 'budget' bounds the expansion cache in bytes (0 = no cache)
+static inline void mac_stream_init(struct MacroStream *ms, struct Lexer *lx,
+                                   int (*is_opcode)(struct StrView), long budget) {
+    memset(ms, 0, sizeof(*ms));
+    mac_init(&ms->mt);
+    xc_init(&ms->cache, budget);
+    ms->lx = lx;
+    ms->is_opcode = is_opcode;
+    ms->max_depth = MAC_MAX_DEPTH;
+}
+
+static inline void mac_stream_free(struct MacroStream *ms) {
+    mac_args_free(&ms->args);
+    xc_free(&ms->cache);
+    for (int i = 0; i < ms->frames_cap; i++)
+        free(ms->frames[i].buf);
+    free(ms->frames);
+    free(ms->key);
+    mac_free(&ms->mt);
+}
+
+// Append bytes to a growable buffer
+static inline void mac_buf_push(char **buf, int *len, int *cap, const void *s, int n) {
+    while (*len + n > *cap) {
+        *cap = *cap ? *cap * 2 : 4096;
+        *buf = realloc(*buf, *cap);
+    }
+    memcpy(*buf + *len, s, n);
+    *len += n;
+}
+
+// Copy a view into a NUL-terminated buffer ("-" if it is empty)
+static inline const char *mac_cstr(struct StrView v, char *buf, int size) {
+    if (v.len == 0)
+        v = view_of("-");
+    if (v.len > size - 1)
+        v.len = size - 1;
+    memcpy(buf, v.p, v.len);
+    buf[v.len] = '\0';
+    return buf;
+}
+
+// Whether 'v' is MEND or one of the conditional expansion keywords
+static inline int mac_is_keyword(struct StrView v) {
+    static const char *const words[] = { "MEND", "IF", "ELSE", "ENDIF", "WHILE", "ENDW" };
+
+    for (size_t i = 0; i < sizeof(words) / sizeof(words[0]); i++)
+        if (view_eq(v, words[i]))
+            return 1;
+    return 0;
+}
+
+// Sort the fields of a statement into label, opcode and operand
+// An indented line has no label; a 2-field line is "opcode operand" if
+// its first field is a macro, a macro keyword (MEND, IF, WHILE...) or
+// (per is_opcode) an instruction or directive, "label opcode" if not
+static inline void mac_sort_fields(struct MacroStream *ms, struct StrView *f, int n,
+                                   struct StrView *label, struct StrView *opcode,
+                                   struct StrView *operand) {
+    struct StrView none = { "-", 1 };
+
+    *label = *operand = none;
+    if (n == 1) {
+        *opcode = f[0];
+    } else if (ms->lx->indented) {
+        *opcode = f[0];
+        *operand = f[1];
+    } else if (n == 2) {
+        int is_op = mac_find(&ms->mt, f[0]) >= 0 || mac_is_keyword(f[0]);
+        if (!is_op && ms->is_opcode != NULL) {
+            ms->opcode_lookups++;
+            is_op = ms->is_opcode(f[0]);
+        }
+        if (is_op) {
+            *opcode = f[0];
+            *operand = f[1];
+        } else {
+            *label = f[0];
+            *opcode = f[1];
+        }
+    } else {
+        *label = f[0];
+        *opcode = f[1];
+        *operand = f[2];
+    }
+}
+
+// Next statement before macro processing: from the innermost expansion
+// that still has lines, or from the source
+// Returns 0 at end of input
+static inline int mac_stream_raw(struct MacroStream *ms, struct StrView *label,
+                                 struct StrView *opcode, struct StrView *operand) {
+    struct StrView f[3];
+    int n;
+
+    while (ms->depth > 0) {
+        struct MacroFrame *fr = &ms->frames[ms->depth - 1];
+        if (fr->pos < fr->len) {
+            struct StrView *out[3] = { label, opcode, operand };
+            for (int i = 0; i < 3; i++) {
+                out[i]->p = fr->buf + fr->pos;
+                out[i]->len = strlen(out[i]->p);
+                fr->pos += out[i]->len + 1;
+            }
+            return 1;
+        }
+        ms->depth--;
+    }
+    if ((n = lex_next(ms->lx, f)) == 0)
+        return 0;
+    mac_sort_fields(ms, f, n, label, opcode, operand);
+    return 1;
+}
+
+// Read a MACRO definition up to its MEND and compile it
+// Inner MACRO/MEND pairs are part of the body: they define another
+// macro each time this one is expanded. A definition read from an
+// expansion replaces an earlier macro of the same name; one in the
+// source itself must not
+static inline void mac_stream_define(struct MacroStream *ms, struct StrView name,
+                                     struct StrView params) {
+    char buf[3][MAC_FIELD_MAX];
+    struct StrView label, opcode, operand;
+    int found, defined, plain, level = 1;
+
+    defined = mac_begin(&ms->mt, mac_cstr(name, buf[0], MAC_FIELD_MAX),
+                        mac_cstr(params, buf[1], MAC_FIELD_MAX), ms->depth > 0) >= 0;
+    if (!defined) {
+        mac_error(ms, "Macro %s defined twice (line %d)", buf[0], ms->lx->line_no);
+    }
+    while ((found = mac_stream_raw(ms, &label, &opcode, &operand))) {
+        // Lines of an inner definition are only text to this macro
+        if (view_eq(opcode, "MACRO")) {
+            level++;
+            plain = 1;
+        } else if (view_eq(opcode, "MEND")) {
+            if (--level == 0)
+                break;
+            plain = 1;
+        } else {
+            plain = level > 1;
+        }
+        if (!defined)
+            continue;
+        mac_cstr(label, buf[0], MAC_FIELD_MAX);
+        mac_cstr(opcode, buf[1], MAC_FIELD_MAX);
+        mac_cstr(operand, buf[2], MAC_FIELD_MAX);
+        if (plain) {
+            mac_add_text(&ms->mt, buf[0], buf[1], buf[2]);
+        } else if (mac_add_line(&ms->mt, buf[0], buf[1], buf[2]) < 0) {
+            mac_error(ms, "Misplaced %s in macro %.*s (line %d)", buf[1], name.len, name.p,
+                      ms->lx->line_no);
+        }
+    }
+    if (!found) {
+        mac_error(ms, "Macro %.*s has no MEND", name.len, name.p);
+    }
+    if (defined && mac_end(&ms->mt) < 0) {
+        mac_error(ms, "IF or WHILE left open in macro %.*s", name.len, name.p);
+    }
+}
+
+// Value of an integer expression of + - * / (no blanks, * and / bind
+// tighter); returns 0, or -1 if 's' is not such an expression
+static inline int mac_eval(const char *s, long *value) {
+    long total = 0;
+    int sign = 1;
+
+    if (*s == '+' || *s == '-')
+        sign = *s++ == '-' ? -1 : 1;
+    for (;;) {
+        char *end;
+        long prod;
+
+        if (*s < '0' || *s > '9')
+            return -1;
+        prod = strtol(s, &end, 10);
+        for (s = end; *s == '*' || *s == '/';) {
+            char op = *s++;
+            if (*s < '0' || *s > '9')
+                return -1;
+            long x = strtol(s, &end, 10);
+            s = end;
+            if (op == '/' && x == 0)
+                return -1;
+            prod = op == '*' ? prod * x : prod / x;
+        }
+        total += sign * prod;
+        if (*s == '\0')
+            break;
+        if (*s != '+' && *s != '-')
+            return -1;
+        sign = *s++ == '-' ? -1 : 1;
+    }
+    *value = total;
+    return 0;
+}
+
+// Evaluate a compiled condition against the current slot values
+static inline int mac_cond_true(const struct MacroStream *ms, const struct MacroCond *c) {
+    char a[MAC_FIELD_MAX], b[MAC_FIELD_MAX];
+    long x, y;
+    int cmp;
+
+    mac_expand_field(&ms->mt, c->lhs, &ms->args, a, MAC_FIELD_MAX);
+    if (c->rel == MAC_REL_TRUE)
+        return a[0] != '\0' && !(mac_eval(a, &x) == 0 && x == 0);
+    mac_expand_field(&ms->mt, c->rhs, &ms->args, b, MAC_FIELD_MAX);
+    if (mac_eval(a, &x) == 0 && mac_eval(b, &y) == 0)
+        cmp = (x > y) - (x < y);
+    else
+        cmp = strcmp(a, b);
+
+    switch (c->rel) {
+    case MAC_REL_EQ: return cmp == 0;
+    case MAC_REL_NE: return cmp != 0;
+    case MAC_REL_LT: return cmp < 0;
+    case MAC_REL_LE: return cmp <= 0;
+    case MAC_REL_GT: return cmp > 0;
+    default: return cmp >= 0;
+    }
+}
+
+// Expand the body of macro 'm' with the bound arguments into a frame
+// ("-" for empty fields)
+// The body runs as a threaded interpreter: every line dispatches
+// straight to the handler of the next one through a table of label
+// addresses, with jumps resolved when the macro was defined
+// Returns 0, or -1 if the expansion was cut short by MAC_MAX_STEPS
+static inline int mac_stream_expand(struct MacroStream *ms, int m, struct MacroFrame *fr) {
+    static void *const ops[] = { &&op_text, &&op_if, &&op_jump, &&op_set, &&op_end };
+    const struct MacroTab *mt = &ms->mt;
+    const struct Macro *mac = &mt->macros[m];
+    const struct MacroLine *ln;
+    char field[MAC_FIELD_MAX];
+    long steps = 0, value;
+    int pc = mac->first, len;
+
+#define MAC_DISPATCH() goto *ops[pc < mac->last ? mt->deftab[pc].op : MAC_END]
+
+    MAC_DISPATCH();
+
+op_text:
+    ln = &mt->deftab[pc++];
+    for (int i = 0; i < 3; i++) {
+        len = mac_expand_field(mt, ln->f[i], &ms->args, field, MAC_FIELD_MAX);
+        if (len == 0) {
+            strcpy(field, "-");
+            len = 1;
+        }
+        mac_buf_push(&fr->buf, &fr->len, &fr->cap, field, len + 1);
+    }
+    MAC_DISPATCH();
+
+op_if:
+    ln = &mt->deftab[pc];
+    if (++steps > MAC_MAX_STEPS) {
+        mac_error(ms, "Macro %s still looping after %d conditions (line %d)",
+                  mt->text + mac->name, MAC_MAX_STEPS, ms->lx->line_no);
+        return -1;
+    }
+    pc = mac_cond_true(ms, &mt->conds[ln->arg]) ? pc + 1 : ln->target;
+    MAC_DISPATCH();
+
+op_jump:
+    pc = mt->deftab[pc].target;
+    MAC_DISPATCH();
+
+op_set:
+    ln = &mt->deftab[pc++];
+    len = mac_expand_field(mt, ln->f[2], &ms->args, field, MAC_FIELD_MAX);
+    if (mac_eval(field, &value) == 0)
+        len = snprintf(field, MAC_FIELD_MAX, "%ld", value);
+    ms->args.val[ln->arg] = mac_args_push(&ms->args, field, len);
+    MAC_DISPATCH();
+
+op_end:
+    return 0;
+#undef MAC_DISPATCH
+}
+
+// Push the expansion of a call whose arguments are bound
+static inline void mac_stream_call(struct MacroStream *ms, int m) {
+    const struct ExpEntry *e;
+    struct MacroFrame *fr;
+
+    if (ms->depth == ms->frames_cap) {
+        int cap = ms->frames_cap ? ms->frames_cap * 2 : 16;
+        ms->frames = realloc(ms->frames, cap * sizeof(struct MacroFrame));
+        memset(ms->frames + ms->frames_cap, 0, (cap - ms->frames_cap) * sizeof(struct MacroFrame));
+        ms->frames_cap = cap;
+    }
+    fr = &ms->frames[ms->depth++];
+    fr->len = fr->pos = 0;
+    if (ms->depth > ms->max_seen)
+        ms->max_seen = ms->depth;
+
+    // Key: the macro index, then every slot value in slot order
+    ms->key_len = 0;
+    mac_buf_push(&ms->key, &ms->key_len, &ms->key_cap, &m, sizeof(m));
+    for (int k = 0; k < ms->args.n; k++) {
+        const char *v = ms->args.buf + ms->args.val[k];
+        mac_buf_push(&ms->key, &ms->key_len, &ms->key_cap, v, strlen(v) + 1);
+    }
+
+    // A hit is one copy of the cached block; a miss expands and stores
+    // it, unless the expansion was cut short (the same call must report
+    // the error again, not replay a truncated block)
+    if ((e = xc_find(&ms->cache, ms->key, ms->key_len)) != NULL)
+        mac_buf_push(&fr->buf, &fr->len, &fr->cap, e->block, e->block_len);
+    else if (mac_stream_expand(ms, m, fr) == 0)
+        xc_insert(&ms->cache, ms->key, ms->key_len, fr->buf, fr->len);
+}
+
+// Next line of the expanded program
+// Calls found in expansions are expanded in turn, and MACRO lines in
+// them define new macros; the views stay valid until the next call
+// Returns 0 at end of input
+static inline int mac_stream_next(struct MacroStream *ms, struct StrView *label,
+                                  struct StrView *opcode, struct StrView *operand) {
+    char buf[MAC_FIELD_MAX];
+
+    while (mac_stream_raw(ms, label, opcode, operand)) {
+        if (view_eq(*opcode, "MACRO")) {
+            mac_stream_define(ms, *label, *operand);
+            continue;
+        }
+
+        int m = mac_find(&ms->mt, *opcode);
+        if (m < 0) {
+            ms->lines_out++;
+            return 1; // Not a macro call: pass the line through
+        }
+
+        // A call: bind the arguments, then expand (or find the expansion)
+        if (ms->depth >= ms->max_depth) {
+            mac_error(ms, "Macro %.*s nested deeper than %d (line %d)", opcode->len,
+                      opcode->p, ms->max_depth, ms->lx->line_no);
+            continue;
+        }
+        if (mac_bind_args(&ms->mt, m, mac_cstr(*operand, buf, MAC_FIELD_MAX), &ms->args) < 0) {
+            mac_error(ms, "Bad arguments '%.*s' for macro %.*s (line %d)", operand->len,
+                      operand->p, opcode->len, opcode->p, ms->lx->line_no);
+        }
+        mac_stream_call(ms, m);
+        ms->calls++;
+        if (ms->echo_calls) {
+            *label = view_of(".");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// mac_stream_next() in the shape of a LineSource callback (asmcore.h)
+static inline int mac_stream_read(void *ctx, struct StrView *label, struct StrView *opcode,
+                                  struct StrView *operand) {
+    return mac_stream_next(ctx, label, opcode, operand);
+}
+
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Memoized macro expansions
+ *
+ * Maps a key (the macro and its bound argument values) to the block of
+ * text the call expanded to, so a call repeated with identical
+ * arguments is served from the block instead of being expanded again.
+ * A block holds the expanded lines as NUL-terminated fields, three per
+ * line: "label\0opcode\0operand\0...".
+ *
+ * The cache is bounded by a byte budget (keys, blocks and entry
+ * headers); when an insertion would exceed it, the least recently used
+ * blocks are evicted first. A budget of 0 turns the cache off.
+ */
+
+#ifndef MACROCACHE_H
+#define MACROCACHE_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "asmtab.h"
+
+#define XC_DEFAULT_BUDGET (1L << 20)
+
+struct ExpEntry {
+    char *key;
+    int key_len;
+    char *block;
+    int block_len;
+    unsigned hash;
+    int chain;        // Next entry in the same bucket, -1 = none
+    int prev, next;   // LRU list; prev is more recently used
+};
+
+struct ExpCache {
+    struct ExpEntry *entries;
+    int nentries, cap;
+    int free_list;    // Evicted entries, linked through 'chain'
+    int *buckets;     // First entry per bucket, -1 = empty
+    int nbuckets;     // Always a power of two
+    int live;
+    int head, tail;   // Most and least recently used
+    long budget, bytes;
+    long hits, misses, evictions;
+};
+
+static inline void xc_init(struct ExpCache *c, long budget) {
+    memset(c, 0, sizeof(*c));
+    c->budget = budget;
+    c->free_list = c->head = c->tail = -1;
+    c->nbuckets = 256;
+    c->buckets = malloc(c->nbuckets * sizeof(int));
+    for (int i = 0; i < c->nbuckets; i++)
+        c->buckets[i] = -1;
+}
+
+static inline void xc_free(struct ExpCache *c) {
+    for (int i = 0; i < c->nentries; i++) {
+        free(c->entries[i].key);
+        free(c->entries[i].block);
+    }
+    free(c->entries);
+    free(c->buckets);
+    memset(c, 0, sizeof(*c));
+}
+
+static inline long xc_entry_bytes(const struct ExpEntry *e) {
+    return e->key_len + e->block_len + (long)sizeof(struct ExpEntry);
+}
+
+static inline void xc_unlink(struct ExpCache *c, int i) {
+    struct ExpEntry *e = &c->entries[i];
+    if (e->prev >= 0) c->entries[e->prev].next = e->next; else c->head = e->next;
+    if (e->next >= 0) c->entries[e->next].prev = e->prev; else c->tail = e->prev;
+}
+
+static inline void xc_push_front(struct ExpCache *c, int i) {
+    struct ExpEntry *e = &c->entries[i];
+    e->prev = -1;
+    e->next = c->head;
+    if (c->head >= 0)
+        c->entries[c->head].prev = i;
+    c->head = i;
+    if (c->tail < 0)
+        c->tail = i;
+}
+
+// Drop the least recently used entry
+static inline void xc_evict(struct ExpCache *c) {
+    int i = c->tail;
+    struct ExpEntry *e = &c->entries[i];
+    int *link = &c->buckets[e->hash & (c->nbuckets - 1)];
+
+    while (*link != i)
+        link = &c->entries[*link].chain;
+    *link = e->chain;
+    xc_unlink(c, i);
+
+    c->bytes -= xc_entry_bytes(e);
+    free(e->key);
+    free(e->block);
+    e->key = e->block = NULL;
+    e->chain = c->free_list;
+    c->free_list = i;
+    c->live--;
+    c->evictions++;
+}
+
+// Double the bucket array and rechain the live entries
+static inline void xc_grow(struct ExpCache *c) {
+    c->nbuckets *= 2;
+    c->buckets = realloc(c->buckets, c->nbuckets * sizeof(int));
+    for (int i = 0; i < c->nbuckets; i++)
+        c->buckets[i] = -1;
+    for (int i = c->head; i >= 0; i = c->entries[i].next) {
+        struct ExpEntry *e = &c->entries[i];
+        int b = e->hash & (c->nbuckets - 1);
+        e->chain = c->buckets[b];
+        c->buckets[b] = i;
+    }
+}
+
+// Cached block for a key, or NULL; a hit makes the entry most recent
+static inline const struct ExpEntry *xc_find(struct ExpCache *c, const char *key, int len) {
+    unsigned h;
+
+    if (c->budget <= 0)
+        return NULL;
+    h = hash_name(key, len);
+    for (int i = c->buckets[h & (c->nbuckets - 1)]; i >= 0; i = c->entries[i].chain) {
+        struct ExpEntry *e = &c->entries[i];
+        if (e->hash == h && e->key_len == len && memcmp(e->key, key, len) == 0) {
+            if (c->head != i) {
+                xc_unlink(c, i);
+                xc_push_front(c, i);
+            }
+            c->hits++;
+            return e;
+        }
+    }
+    c->misses++;
+    return NULL;
+}
+
+// Store a copy of a block, evicting old ones to stay within the budget
+// Returns the new entry, or NULL if the block alone exceeds the budget
+static inline const struct ExpEntry *xc_insert(struct ExpCache *c, const char *key, int len,
+                                               const char *block, int block_len) {
+    long need = len + block_len + (long)sizeof(struct ExpEntry);
+    int i;
+
+    if (need > c->budget)
+        return NULL;
+    while (c->bytes + need > c->budget)
+        xc_evict(c);
+
+    if (c->free_list >= 0) {
+        i = c->free_list;
+        c->free_list = c->entries[i].chain;
+    } else {
+        if (c->nentries == c->cap) {
+            c->cap = c->cap ? c->cap * 2 : 64;
+            c->entries = realloc(c->entries, c->cap * sizeof(struct ExpEntry));
+        }
+        i = c->nentries++;
+    }
+    if (c->live >= c->nbuckets)
+        xc_grow(c);
+
+    struct ExpEntry *e = &c->entries[i];
+    e->key = malloc(len);
+    memcpy(e->key, key, len);
+    e->key_len = len;
+    e->block = malloc(block_len);
+    memcpy(e->block, block, block_len);
+    e->block_len = block_len;
+    e->hash = hash_name(key, len);
+    e->chain = c->buckets[e->hash & (c->nbuckets - 1)];
+    c->buckets[e->hash & (c->nbuckets - 1)] = i;
+    xc_push_front(c, i);
+    c->bytes += need;
+    c->live++;
+    return e;
+}
+
+#endif
@@ -1,123 +1,106 @@
+/*
+ * Single Pass Macroprocessor
+ *
+ * Reads inputm.txt and writes the expanded program to op.txt.
+ * NAMTAB and DEFTAB are kept in memory (macro.h): a macro call is one
+ * hash lookup plus a copy of the macro's precompiled body, with the
+ * arguments dropped into their parameter slots.
+ *
+ * The expansion itself is the line stream of macro.h; this program
+ * only writes it out. The assembler can read the same stream directly
+ * (asm -M, pass1 -M) without going through op.txt.
+ *
+ * Usage: onepassmacro [-t] [-c KB] [-d depth]
+ *   -t     Also write namtab.txt and deftab.txt and print all files
+ *   -c KB  Memory budget of the expansion cache (default 1024, 0 = off):
+ *          a call repeated with the same arguments is copied from the
+ *          cached expansion of the first one (macrocache.h)
+ *   -d N   Nesting limit of macro calls (default 256)
+ *
+ * Macro bodies may call other macros, recursively, and may define new
+ * macros with inner MACRO...MEND pairs.
+ * They may also expand conditionally with IF/ELSE/ENDIF, WHILE/ENDW
+ * and SET variables (see macro.h).
+ */
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-int main() {
-    FILE *f1, *f2, *f3, *f5;
-    int i, argCount = 0;
-    char la[20], mne[20], opnd[50];
-    char name[20], mne1[20], opnd1[50], argtab[10][20];
+#include "asmcore.h"
+#include "macro.h"
+
+int main(int argc, char *argv[]) {
+    FILE *f5;
+    int i, dump = 0, ended = 0;
+    int max_depth = MAC_MAX_DEPTH;
+    long budget = XC_DEFAULT_BUDGET;
+    struct Lexer lx;
+    struct MacroStream ms;
+    struct StrView la, mne, opnd;
 
-    f1 = fopen("inputm.txt", "r");
-    f2 = fopen("namtab.txt", "w+");
-    f3 = fopen("deftab.txt", "w+");
-    f5 = fopen("op.txt", "w+");
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0) {
+            dump = 1;
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            budget = atol(argv[++i]) * 1024;
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            max_depth = atoi(argv[++i]);
+        } else {
+            printf("Usage: %s [-t] [-c KB] [-d depth]\n", argv[0]);
+            return 1;
+        }
+    }
 
-    if (!f1) {
+    if (lex_open(&lx, "inputm.txt") < 0) {
         printf(" Error: inputm.txt not found.\n");
         return 1;
     }
-
-    fscanf(f1, "%s%s%s", la, mne, opnd);
-
-    while (strcmp(mne, "END") != 0) {
-        if (strcmp(mne, "MACRO") == 0) {
-            char formal_params[10][20];
-            int param_count = 0;
-            
-            fprintf(f2, "%s\n", la);
-            rewind(f2);
-            fprintf(f3, "%s\t%s\n", la, opnd);
-
-            char temp_opnd[50];
-            strcpy(temp_opnd, opnd);
-            char *token = strtok(temp_opnd, ",");
-            while (token != NULL) {
-                strcpy(formal_params[param_count++], token);
-                token = strtok(NULL, ",");
-            }
-
-            fscanf(f1, "%s%s%s", la, mne, opnd);
-            while (strcmp(mne, "MEND") != 0) {
-                if (opnd[0] == '&') {
-                    for (int k = 0; k < param_count; k++) {
-                        if (strcmp(opnd, formal_params[k]) == 0) {
-                            sprintf(opnd, "?%d", k + 1);
-                            break;
-                        }
-                    }
-                }
-                fprintf(f3, "%s\t%s\n", mne, opnd);
-                fscanf(f1, "%s%s%s", la, mne, opnd);
-            }
-            fprintf(f3, "%s\n", mne);
-        } else {
-            rewind(f2);
-            int found = 0;
-            while (fscanf(f2, "%s", name) != EOF) {
-                if (strcmp(mne, name) == 0) {
-                    found = 1;
-                    break;
-                }
-            }
-
-            if (found) {
-                argCount = 0;
-                char *token = strtok(opnd, ",");
-                while (token != NULL) {
-                    strcpy(argtab[argCount++], token);
-                    token = strtok(NULL, ",");
-                }
-
-                rewind(f3);
-                while(fscanf(f3, "%s%s", mne1, opnd1) != EOF) {
-                    if (strcmp(mne1, mne) == 0) {
-                        break;
-                    }
-                }
-
-                fprintf(f5, ".\t%s\t", mne);
-                for (i = 0; i < argCount; i++) {
-                    fprintf(f5, "%s%s", argtab[i], (i == argCount - 1) ? "" : ",");
-                }
-                fprintf(f5, "\n");
-
-                while (fscanf(f3, "%s%s", mne1, opnd1) != EOF && strcmp(mne1, "MEND") != 0) {
-                    if (opnd1[0] == '?') {
-                        int index = opnd1[1] - '1';
-                        if (index >= 0 && index < argCount) {
-                            fprintf(f5, "-\t%s\t%s\n", mne1, argtab[index]);
-                        }
-                    } else {
-                        fprintf(f5, "-\t%s\t%s\n", mne1, opnd1);
-                    }
-                }
-            } else {
-                fprintf(f5, "%s\t%s\t%s\n", la, mne, opnd);
-            }
-        }
-        fscanf(f1, "%s%s%s", la, mne, opnd);
+    f5 = fopen("op.txt", "w");
+    if (!f5) {
+        printf(" Error: Cannot create op.txt\n");
+        return 1;
     }
+    mac_stream_init(&ms, &lx, asm_is_opcode, budget);
+    ms.echo_calls = 1;
+    ms.max_depth = max_depth;
 
-    fprintf(f5, "%s\t%s\t%s\n", la, mne, opnd);
-    fclose(f1);
-    fclose(f2);
-    fclose(f3);
+    // Copy the expanded program up to END; the end of the input reads as END
+    while (mac_stream_next(&ms, &la, &mne, &opnd)) {
+        fprintf(f5, "%.*s\t%.*s\t%.*s\n", la.len, la.p, mne.len, mne.p, opnd.len, opnd.p);
+        if ((ended = view_eq(mne, "END")))
+            break;
+    }
+    if (!ended)
+        fprintf(f5, "-\tEND\t-\n");
+    lex_close(&lx);
     fclose(f5);
 
     printf("\n Successfully implemented Single Pass Macroprocessor.\n");
+    printf(" Expansion cache: %ld hit(s), %ld miss(es), %ld eviction(s), %ld bytes\n",
+           ms.cache.hits, ms.cache.misses, ms.cache.evictions, ms.cache.bytes);
 
-    char *filenames[] = {"inputm.txt", "namtab.txt", "deftab.txt", "op.txt"};
-    char buffer[200];
-    for (i = 0; i < 4; i++) {
-        FILE *fp = fopen(filenames[i], "r");
-        if (!fp) continue;
-        printf("\n========== %s ==========\n", filenames[i]);
-        while (fgets(buffer, sizeof(buffer), fp) != NULL) {
-            printf("%s", buffer);
+    if (dump) {
+        FILE *f2 = fopen("namtab.txt", "w");
+        FILE *f3 = fopen("deftab.txt", "w");
+        if (f2 && f3)
+            mac_dump(&ms.mt, f2, f3);
+        if (f2) fclose(f2);
+        if (f3) fclose(f3);
+
+        char *filenames[] = {"inputm.txt", "namtab.txt", "deftab.txt", "op.txt"};
+        char buffer[200];
+        for (i = 0; i < 4; i++) {
+            FILE *fp = fopen(filenames[i], "r");
+            if (!fp) continue;
+            printf("\n========== %s ==========\n", filenames[i]);
+            while (fgets(buffer, sizeof(buffer), fp) != NULL) {
+                printf("%s", buffer);
+            }
+            fclose(fp);
         }
-        fclose(fp);
     }
 
-    return 0;
+    mac_stream_free(&ms);
+    return ms.error_flag;
 }
@@ -0,0 +1,298 @@
+/*
+ * SIC/XE opcode table -- generated by gen_optab from optab.txt, do not edit
+ *
+ * Perfect hash: 59 mnemonics in 256 slots, seed 1033.
+ */
+
+#ifndef OPTAB_GEN_H
+#define OPTAB_GEN_H
+
+#include <string.h>
+
+#define OPTAB_COUNT 59
+#define OPTAB_SLOTS 256
+#define OPTAB_SEED 1033u
+
+struct OpInfo {
+    const char *name;  // NULL for an empty slot
+    int len;
+    int opcode;
+    int format;        // 1, 2 or 3 (3 also allows +format 4)
+};
+
+static const struct OpInfo optab_entries[OPTAB_SLOTS] = {
+    { "LDX", 3, 0x04, 3 },
+    { "MULF", 4, 0x60, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDA", 3, 0x00, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "HIO", 3, 0xF4, 1 },
+    { 0, 0, 0, 0 },
+    { "STI", 3, 0xD4, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "TIO", 3, 0xF8, 1 },
+    { 0, 0, 0, 0 },
+    { "JEQ", 3, 0x30, 3 },
+    { "STB", 3, 0x78, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "SHIFTL", 6, 0xA4, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "FLOAT", 5, 0xC0, 1 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "SVC", 3, 0xB0, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "TIXR", 4, 0xB8, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "JSUB", 4, 0x48, 3 },
+    { 0, 0, 0, 0 },
+    { "LDF", 3, 0x70, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "DIVF", 4, 0x64, 3 },
+    { 0, 0, 0, 0 },
+    { "SHIFTR", 6, 0xA8, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "AND", 3, 0x40, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "COMPF", 5, 0x88, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "COMPR", 5, 0xA0, 2 },
+    { "SUBR", 4, 0x94, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "STSW", 4, 0xE8, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "SIO", 3, 0xF0, 1 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "MUL", 3, 0x20, 3 },
+    { "JGT", 3, 0x34, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "ADD", 3, 0x18, 3 },
+    { 0, 0, 0, 0 },
+    { "STL", 3, 0x14, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "SUB", 3, 0x1C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "SSK", 3, 0xEC, 3 },
+    { 0, 0, 0, 0 },
+    { "RD", 2, 0xD8, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "STCH", 4, 0x54, 3 },
+    { 0, 0, 0, 0 },
+    { "MULR", 4, 0x98, 2 },
+    { 0, 0, 0, 0 },
+    { "CLEAR", 5, 0xB4, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "ADDR", 4, 0x90, 2 },
+    { "OR", 2, 0x44, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "COMP", 4, 0x28, 3 },
+    { 0, 0, 0, 0 },
+    { "STA", 3, 0x0C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDS", 3, 0x6C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDT", 3, 0x74, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDCH", 4, 0x50, 3 },
+    { "ADDF", 4, 0x58, 3 },
+    { "DIV", 3, 0x24, 3 },
+    { "SUBF", 4, 0x5C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "RMO", 3, 0xAC, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "DIVR", 4, 0x9C, 2 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "WD", 2, 0xDC, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "STT", 3, 0x84, 3 },
+    { 0, 0, 0, 0 },
+    { "TIX", 3, 0x2C, 3 },
+    { 0, 0, 0, 0 },
+    { "TD", 2, 0xE0, 3 },
+    { "STS", 3, 0x7C, 3 },
+    { "STF", 3, 0x80, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "RSUB", 4, 0x4C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LPS", 3, 0xD0, 3 },
+    { "JLT", 3, 0x38, 3 },
+    { "NORM", 4, 0xC8, 1 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDB", 3, 0x68, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "J", 1, 0x3C, 3 },
+    { 0, 0, 0, 0 },
+    { 0, 0, 0, 0 },
+    { "LDL", 3, 0x08, 3 },
+    { "FIX", 3, 0xC4, 1 },
+    { "STX", 3, 0x10, 3 },
+    { 0, 0, 0, 0 },
+};
+
+static inline unsigned optab_hash(const char *s, int len) {
+    unsigned h = 2166136261u ^ OPTAB_SEED;
+    for (int i = 0; i < len; i++) {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h ^ (h >> 15);
+}
+
+// Returns the slot of a mnemonic, or -1 if it is not an instruction
+static inline int optab_lookup(const char *s, int len) {
+    int slot = optab_hash(s, len) & (OPTAB_SLOTS - 1);
+    const struct OpInfo *e = &optab_entries[slot];
+    return e->name && e->len == len && memcmp(e->name, s, len) == 0 ? slot : -1;
+}
+
+#endif
@@ -3,128 +3,78 @@
  *
  * This program reads from:
  * 1. input.txt  (Source Code)
- * 2. optab.txt   (Opcode Table)
+ *
+ * The opcode table is compiled in (optab_gen.h, generated from
+ * optab.txt by gen_optab).
  *
  * It produces:
  * 1. intermediate.txt (Source with addresses)
  * 2. symtab.txt       (Symbol Table)
  * 3. length.txt       (Program Length)
+ *
+ * The pass itself lives in asmcore.h and is shared with the fused
+ * assembler (asm.c); this program only writes its results as text.
+ *
+ * Usage: pass1 [-M]
+ *   -M  Expand macros (macro.h) on the way in: pass 1 reads the
+ *       expanded statements straight from the macro processor
  */
 
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 
-// Function to search OPTAB
-// Returns 1 if found (and sets instruction length), 0 if not found
-int search_optab(FILE *optab, const char *opcode, int *instr_length) {
-    char op[20], len_str[10];
-    rewind(optab); // Start search from the beginning of OPTAB
+#include "asmcore.h"
+#include "macro.h"
+
+int main(int argc, char *argv[]) {
+    FILE *f_inter, *f_symtab, *f_length;
+    struct Lexer lx;
+    struct Assembly as;
+    struct MacroStream ms;
+    struct LineSource src = { mac_stream_read, &ms };
+    int error_flag, macros = 0;
 
-    while (fscanf(optab, "%s %s", op, len_str) != EOF) {
-        if (strcmp(opcode, op) == 0) {
-            *instr_length = atoi(len_str);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-M") == 0) {
+            macros = 1;
+        } else {
+            printf("Usage: %s [-M]\n", argv[0]);
             return 1;
         }
     }
-    return 0;
-}
 
-// Function to search SYMTAB
-// Returns 1 if found, 0 if not found
-int search_symtab(FILE *symtab, const char *label) {
-    char sym[20], addr_str[10];
-    rewind(symtab); // Start search from the beginning of SYMTAB
-
-    while (fscanf(symtab, "%s %s", sym, addr_str) != EOF) {
-        if (strcmp(label, sym) == 0) {
-            return 1; // Found
-        }
+    // 1. Map the source
+    if (lex_open(&lx, "input.txt") < 0) {
+        printf("Error: Cannot open input.txt\n");
+        return 1;
+    }
+    asm_init(&as);
+    if (macros) {
+        mac_stream_init(&ms, &lx, asm_is_opcode, XC_DEFAULT_BUDGET);
+        as.source = &src;
     }
-    return 0;
-}
 
-int main() {
-    FILE *f_input, *f_optab, *f_inter, *f_symtab, *f_length;
-    int locctr, start_addr, instr_length, prog_length;
-    char label[20], opcode[20], operand[20];
-    int error_flag = 0;
+    // 2. Run Pass 1 over the source (or over its expansion)
+    error_flag = asm_pass1(&as, &lx);
+    lex_close(&lx);
+    if (macros) {
+        error_flag |= ms.error_flag;
+        mac_stream_free(&ms);
+    }
 
-    // 1. Open all files
-    f_input = fopen("input.txt", "r");
-    f_optab = fopen("optab.txt", "r");
+    // 3. Write intermediate file, SYMTAB and program length
     f_inter = fopen("intermediate.txt", "w");
     f_symtab = fopen("symtab.txt", "w");
     f_length = fopen("length.txt", "w");
-
-    if (f_input == NULL || f_optab == NULL) {
-        printf("Error: Cannot open input.txt or optab.txt\n");
+    if (!f_inter || !f_symtab || !f_length) {
+        printf("Error: Cannot create output files\n");
         return 1;
     }
+    asm_write_intermediate(&as, f_inter, f_symtab, f_length);
 
-    // 2. Read First Line and Handle START
-    fscanf(f_input, "%s %s %s", label, opcode, operand);
-
-    if (strcmp(opcode, "START") == 0) {
-        start_addr = (int)strtol(operand, NULL, 16); // Convert hex string to int
-        locctr = start_addr;
-        fprintf(f_inter, "%X\t%s\t%s\t%s\n", locctr, label, opcode, operand);
-        fscanf(f_input, "%s %s %s", label, opcode, operand); // Read next line
-    } else {
-        start_addr = 0;
-        locctr = 0;
-    }
-
-    // 3. Main Processing Loop (while opcode is not END)
-    while (strcmp(opcode, "END") != 0) {
-        
-        // A. Write line to intermediate file
-        fprintf(f_inter, "%X\t%s\t%s\t%s\n", locctr, label, opcode, operand);
-
-        // B. Handle Label
-        if (strcmp(label, "-") != 0) { // If a label exists
-            if (search_symtab(f_symtab, label)) {
-                printf("ERROR: Duplicate symbol '%s' at %X\n", label, locctr);
-                error_flag = 1;
-            } else {
-                fprintf(f_symtab, "%s\t%X\n", label, locctr); // Add to SYMTAB
-            }
-        }
-
-        // C. Process Opcode and increment LOCCTR
-        if (search_optab(f_optab, opcode, &instr_length)) {
-            locctr += instr_length;
-        } else if (strcmp(opcode, "WORD") == 0) {
-            locctr += 3;
-        } else if (strcmp(opcode, "RESW") == 0) {
-            locctr += (3 * atoi(operand));
-        } else if (strcmp(opcode, "RESB") == 0) {
-            locctr += atoi(operand);
-        } else if (strcmp(opcode, "BYTE") == 0) {
-            // C'EOF' -> 3 bytes
-            // X'F1'  -> 1 byte
-            if (operand[0] == 'C') {
-                locctr += (strlen(operand) - 3); // -3 for C' '
-            } else if (operand[0] == 'X') {
-                locctr += (strlen(operand) - 3) / 2; // /2 for X' '
-            }
-        } else {
-            printf("ERROR: Invalid opcode '%s' at %X\n", opcode, locctr);
-            error_flag = 1;
-        }
-
-        // D. Read next line
-        fscanf(f_input, "%s %s %s", label, opcode, operand);
-    }
-
-    // 4. Handle END directive
-    fprintf(f_inter, "%X\t%s\t%s\t%s\n", locctr, label, opcode, operand);
-
-    // 5. Calculate Program Length
-    prog_length = locctr - start_addr;
-    fprintf(f_length, "%X\n", prog_length); // Write length in hex
     printf("\nPass 1 complete.\n");
-    printf("Program Length: %X\n", prog_length);
+    printf("Program Length: %X\n", as.prog_length);
 
     if (error_flag) {
         printf("Errors found. Check output.\n");
@@ -132,12 +82,11 @@ int main() {
         printf("Intermediate file and SYMTAB created successfully.\n");
     }
 
-    // 6. Close all files
-    fclose(f_input);
-    fclose(f_optab);
+    // 4. Close all files
     fclose(f_inter);
     fclose(f_symtab);
     fclose(f_length);
+    asm_free(&as);
 
     return 0;
 }
@@ -1,76 +1,314 @@
+/*
+ * Relocating Loader
+ *
+ * Loads RLIN.txt (or a binary object program, sicobj.h) into a memory
+ * image and relocates it to the address typed in. The relocation
+ * bitmask of a T-record is kept as a 64-bit integer, bit i for word i,
+ * and only its set bits are visited (count trailing zeros), so the
+ * cost follows the number of relocatable words; the other words stay
+ * exactly as they were loaded. RLOUT.txt is formatted from the image
+ * and written with one call.
+ *
+ * SIC/XE programs (format-4 instructions, 20-bit fields) are relocated
+ * with M-records instead. Their fixups are collected while loading,
+ * sorted by address and applied in a single pass over the finished
+ * image.
+ *
+ * The address typed in is the new load address of the program's first
+ * byte in both formats: each relocated address field moves by that
+ * address minus the start address of the H-record (or binary header).
+ *
+ * RLIN.txt: H name start length
+ *           T addr len mask hex...   (hex: the record's bytes, in any
+ *                                     split, e.g. "14 1033" or "4B101036")
+ *           M addr halfbytes [+name|-name]
+ *           E
+ */
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include "hexdec.h"
+#include "loadutil.h"
+#include "sicobj.h"
+
+#define MASK_MAX_DIGITS 16   // 64 words per T-record
+
+// The words of one T-record in the image
+struct Segment {
+    int off, len;            // Byte offset and length
+};
+
+// One M-record: a field of 'halfbytes' nibbles ending at the last
+// nibble of byte off + (halfbytes + 1) / 2 - 1
+struct Fixup {
+    int off;
+    int halfbytes;
+    int sign;                // +1 or -1
+};
 
-void convert(char hex_mask[], char bit_mask[]);
 void display_file_content(const char *filename);
+int relocate_binary(const char *filename, int start_addr);
 
-int main(void) {
-    char add_str[7], length_str[7], input[10], bitmask_hex[13], pn[7];
-    char bitmask_bin[49];
-    int start_addr, text_addr, text_len, i, opcode, addr, actual_addr;
-    FILE *fp1, *fp2;
+// Next blank-separated token; returns its length (0 at the end)
+int next_token(const char **p, const char *end, const char **tok) {
+    const char *s = *p;
 
-    printf("Enter the actual starting address: ");
-    scanf("%x", &start_addr);
+    while (s < end && (*s == ' ' || *s == '\t' || *s == '\r' || *s == '\n'))
+        s++;
+    *tok = s;
+    while (s < end && *s != ' ' && *s != '\t' && *s != '\r' && *s != '\n')
+        s++;
+    *p = s;
+    return s - *tok;
+}
 
-    fp1 = fopen("RLIN.txt", "r");
-    if (fp1 == NULL) {
-        printf("Error: Cannot open RLIN.txt\n");
-        return 1;
-    }
+// Next token as a hex number, or -1 if it is missing or not hex
+int next_hex(const char **p, const char *end) {
+    const char *tok;
+    int len = next_token(p, end, &tok);
 
-    fp2 = fopen("RLOUT.txt", "w");
-    if (fp2 == NULL) {
-        printf("Error: Cannot open RLOUT.txt\n");
-        fclose(fp1);
-        return 1;
+    return len > 0 && len <= 7 ? hex_field(tok, len) : -1;
+}
+
+uint64_t reverse_bits64(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+    v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(v);
+}
+
+// Parse a hex bitmask (first word in its most significant bit) into a
+// bitset with word i in bit i; returns 0, or -1 if it is not hex
+int parse_mask(const char *tok, int len, uint64_t *bits) {
+    uint64_t v = 0;
+
+    if (len == 0 || len > MASK_MAX_DIGITS)
+        return -1;
+    for (int i = 0; i < len; i++) {
+        int d = hex_digit(tok[i]);
+        if (d < 0)
+            return -1;
+        v = (v << 4) | d;
     }
+    *bits = reverse_bits64(v << (64 - 4 * len));
+    return 0;
+}
+
+// Add 'delta' to the 16-bit address in the last two bytes of a word
+void patch_addr16(unsigned char *w, int delta) {
+    int addr = ((w[1] << 8 | w[2]) + delta) & 0xFFFF;
+
+    w[1] = addr >> 8;
+    w[2] = addr & 0xFF;
+}
 
-    fscanf(fp1, "%s", input);
+// Relocate the words starting at 'words' whose bits are set
+void relocate_words(unsigned char *words, uint64_t bits, int delta) {
+    for (; bits != 0; bits &= bits - 1)
+        patch_addr16(words + 3 * __builtin_ctzll(bits), delta);
+}
 
-    fprintf(fp2, "----------------------------\n");
-    fprintf(fp2, " ADDRESS   CONTENT\n");
-    fprintf(fp2, "----------------------------\n");
+int fixup_cmp(const void *a, const void *b) {
+    return ((const struct Fixup *)a)->off - ((const struct Fixup *)b)->off;
+}
 
-    while (strcmp(input, "E") != 0) {
-        if (strcmp(input, "H") == 0) {
-            fscanf(fp1, "%s %s %s", pn, add_str, length_str);
-            fscanf(fp1, "%s", input);
+// Apply the M-record fixups in address order, in one pass over the image
+// Returns 0, or -1 if one lies outside the image
+int apply_fixups(unsigned char *image, int image_len, struct Fixup *fix, int nfix, int sorted,
+                 int delta) {
+    if (!sorted)
+        qsort(fix, nfix, sizeof(struct Fixup), fixup_cmp);
+    for (int i = 0; i < nfix; i++) {
+        if (fix[i].off + (fix[i].halfbytes + 1) / 2 > image_len) {
+            printf("Error: M record at %06X lies outside the program\n", fix[i].off);
+            return -1;
         }
+        patch_field(image + fix[i].off, fix[i].halfbytes, fix[i].sign * delta);
+    }
+    return 0;
+}
 
-        if (strcmp(input, "T") == 0) {
-            fscanf(fp1, "%x", &text_addr);
-            fscanf(fp1, "%x", &text_len);
-            fscanf(fp1, "%s", bitmask_hex);
+// Write the words of every segment as " ADDR   CONTENT" lines
+// 'base' is the address of image[0]
+int write_rlout(const char *filename, const unsigned char *image, const struct Segment *seg,
+                int nseg, int base) {
+    long nwords = 0;
+    char *out, *q;
+    FILE *fp;
+    int ok;
 
-            text_addr += start_addr;
+    for (int s = 0; s < nseg; s++)
+        nwords += (seg[s].len + 2) / 3;
+    if ((fp = fopen(filename, "w")) == NULL) {
+        printf("Error: Cannot open %s\n", filename);
+        return -1;
+    }
+    q = out = malloc(nwords * 24 + 128);
+    q += sprintf(q, "----------------------------\n");
+    q += sprintf(q, " ADDRESS   CONTENT\n");
+    q += sprintf(q, "----------------------------\n");
+    for (int s = 0; s < nseg; s++) {
+        int end = seg[s].off + seg[s].len, off;
+        for (off = seg[s].off; off + 3 <= end; off += 3)
+            q += sprintf(q, " %04X\t   %02X%02X%02X\n", base + off, image[off], image[off + 1],
+                         image[off + 2]);
+        if (off < end) {
+            // A record that does not end on a word boundary (SIC/XE)
+            q += sprintf(q, " %04X\t   ", base + off);
+            for (; off < end; off++)
+                q += sprintf(q, "%02X", image[off]);
+            *q++ = '\n';
+        }
+    }
+    q += sprintf(q, "----------------------------\n");
+    ok = fwrite(out, 1, q - out, fp) == (size_t)(q - out);
+    free(out);
+    fclose(fp);
+    return ok ? 0 : -1;
+}
 
-            convert(bitmask_hex, bitmask_bin);
+// Load RLIN.txt into an image, relocating each T-record as it arrives
+// and the M-records once everything is loaded
+// Returns 0, or 1 on errors
+int relocate_text(int start_addr) {
+    const char *p, *end, *tok, *prog_name = "";
+    unsigned char *image = NULL;
+    struct Segment *seg = NULL;
+    struct Fixup *fix = NULL;
+    int nseg = 0, seg_cap = 0, nfix = 0, fix_cap = 0, sorted = 1;
+    int prog_start = 0, prog_len = 0, name_len = 0, delta = 0, len, status = 0;
+    char *buf;
+    long size;
 
-            int num_instructions = text_len / 3;
+    if ((size = read_file("RLIN.txt", &buf)) < 0) {
+        printf("Error: Cannot open RLIN.txt\n");
+        return 1;
+    }
+
+    p = buf;
+    end = buf + size;
+    while ((len = next_token(&p, end, &tok)) > 0 && !(len == 1 && tok[0] == 'E')) {
+        if (len == 1 && tok[0] == 'H' && image == NULL) {
+            name_len = next_token(&p, end, &prog_name);
+            prog_start = next_hex(&p, end);
+            prog_len = next_hex(&p, end);
+            if (prog_start < 0 || prog_len < 0) {
+                printf("Error: Bad H record in RLIN.txt\n");
+                status = 1;
+                break;
+            }
+            delta = start_addr - prog_start;
+            image = calloc(prog_len + 3, 1);
+        } else if (len == 1 && tok[0] == 'T' && image != NULL) {
+            int text_addr = next_hex(&p, end);
+            int text_len = next_hex(&p, end);
+            int off = text_addr - prog_start, nwords = text_len / 3;
+            uint64_t bits;
 
-            for (i = 0; i < num_instructions; i++) {
-                fscanf(fp1, "%x %x", &opcode, &addr);
+            len = next_token(&p, end, &tok);
+            if (text_addr < 0 || text_len < 0 || parse_mask(tok, len, &bits) < 0 ||
+                off < 0) {
+                printf("Error: Bad T record in RLIN.txt\n");
+                status = 1;
+                break;
+            }
+            if (off + text_len > prog_len) {
+                // Text past the H-record length: grow the image
+                image = realloc(image, off + text_len + 3);
+                memset(image + prog_len, 0, off + text_len + 3 - prog_len);
+                prog_len = off + text_len;
+            }
 
-                if (bitmask_bin[i] == '1') {
-                    actual_addr = addr + start_addr;
-                } else {
-                    actual_addr = addr;
+            // Load the bytes, then relocate the marked words
+            for (int n = 0; n < text_len; n += len / 2) {
+                len = next_token(&p, end, &tok);
+                if (len == 0 || len % 2 != 0 || n + len / 2 > text_len ||
+                    hex_decode(image + off + n, tok, len / 2) < 0) {
+                    printf("Error: Bad instruction in RLIN.txt\n");
+                    status = 1;
+                    break;
                 }
+            }
+            if (status)
+                break;
+            if (nwords < 64)
+                bits &= (1ULL << nwords) - 1;
+            relocate_words(image + off, bits, delta);
+
+            if (nseg == seg_cap) {
+                seg_cap = seg_cap ? seg_cap * 2 : 64;
+                seg = realloc(seg, seg_cap * sizeof(struct Segment));
+            }
+            seg[nseg].off = off;
+            seg[nseg++].len = text_len;
+        } else if (len == 1 && tok[0] == 'M' && image != NULL) {
+            int addr = next_hex(&p, end);
+            int halfbytes = next_hex(&p, end);
+            const char *save = p;
+            int sign = 1;
 
-                fprintf(fp2, " %04X\t   %02X%04X\n", text_addr, opcode, actual_addr);
+            // Optional +name / -name; only this program can be named here
+            len = next_token(&p, end, &tok);
+            if (len > 0 && (tok[0] == '+' || tok[0] == '-')) {
+                sign = tok[0] == '-' ? -1 : 1;
+                if (len - 1 != name_len || memcmp(tok + 1, prog_name, name_len) != 0) {
+                    printf("Error: External symbol '%.*s' in RLIN.txt\n", len - 1, tok + 1);
+                    status = 1;
+                    break;
+                }
+            } else {
+                p = save;
+            }
+            if (addr < prog_start || halfbytes < 1 || halfbytes > 8) {
+                printf("Error: Bad M record in RLIN.txt\n");
+                status = 1;
+                break;
+            }
 
-                text_addr += 3;
+            if (nfix == fix_cap) {
+                fix_cap = fix_cap ? fix_cap * 2 : 256;
+                fix = realloc(fix, fix_cap * sizeof(struct Fixup));
             }
-            fscanf(fp1, "%s", input);
+            if (nfix > 0 && addr - prog_start < fix[nfix - 1].off)
+                sorted = 0;
+            fix[nfix].off = addr - prog_start;
+            fix[nfix].halfbytes = halfbytes;
+            fix[nfix++].sign = sign;
+        } else {
+            printf("Error: Unexpected '%.*s' in RLIN.txt\n", len, tok);
+            status = 1;
+            break;
         }
     }
 
-    fprintf(fp2, "----------------------------\n");
+    if (status == 0 && nfix > 0 &&
+        apply_fixups(image, prog_len, fix, nfix, sorted, delta) < 0)
+        status = 1;
+    if (write_rlout("RLOUT.txt", image, seg, nseg, start_addr) < 0)
+        status = 1;
+    free(image);
+    free(seg);
+    free(fix);
+    free(buf);
+    return status;
+}
+
+// Usage: reloc [objfile.bin]  (without an argument RLIN.txt is used)
+// Asks for the hex address to load the program at
+int main(int argc, char *argv[]) {
+    int start_addr, status;
+
+    printf("Enter the actual starting address: ");
+    if (scanf("%x", &start_addr) != 1)
+        return 1;
 
-    fclose(fp2);
-    fclose(fp1);
+    if (argc > 1)
+        return relocate_binary(argv[1], start_addr);
+
+    status = relocate_text(start_addr);
 
     printf("\n Relocating loader finished.\n");
 
@@ -81,33 +319,47 @@ int main(void) {
     display_file_content("RLOUT.txt");
     printf("\n");
 
-    return 0;
+    return status;
 }
 
-void convert(char hex_mask[], char bit_mask[]) {
-    int i;
-    strcpy(bit_mask, "");
-
-    for (i = 0; i < strlen(hex_mask); i++) {
-        switch (hex_mask[i]) {
-            case '0': strcat(bit_mask, "0000"); break;
-            case '1': strcat(bit_mask, "0001"); break;
-            case '2': strcat(bit_mask, "0010"); break;
-            case '3': strcat(bit_mask, "0011"); break;
-            case '4': strcat(bit_mask, "0100"); break;
-            case '5': strcat(bit_mask, "0101"); break;
-            case '6': strcat(bit_mask, "0110"); break;
-            case '7': strcat(bit_mask, "0111"); break;
-            case '8': strcat(bit_mask, "1000"); break;
-            case '9': strcat(bit_mask, "1001"); break;
-            case 'A': case 'a': strcat(bit_mask, "1010"); break;
-            case 'B': case 'b': strcat(bit_mask, "1011"); break;
-            case 'C': case 'c': strcat(bit_mask, "1100"); break;
-            case 'D': case 'd': strcat(bit_mask, "1101"); break;
-            case 'E': case 'e': strcat(bit_mask, "1110"); break;
-            case 'F': case 'f': strcat(bit_mask, "1111"); break;
+// Relocate a binary object program (see sicobj.h) to start_addr
+// The program is mapped once into an image; its bitmap (bit i = byte
+// offset i) is scanned 64 bits at a time and only set bits are patched
+int relocate_binary(const char *filename, int start_addr) {
+    struct SicObj obj;
+    struct Segment all;
+    int delta, nbytes, status;
+
+    if (sicobj_read(filename, &obj) < 0) {
+        printf("Error: %s is not a binary object program\n", filename);
+        return 1;
+    }
+
+    delta = start_addr - obj.start;
+    nbytes = (obj.length + 7) / 8;
+    for (int base = 0; base < obj.length; base += 64) {
+        uint64_t bits = 0;
+        for (int k = 0; k < 8 && base / 8 + k < nbytes; k++)
+            bits |= (uint64_t)obj.reloc[base / 8 + k] << (8 * k);
+        for (; bits != 0; bits &= bits - 1) {
+            int off = base + __builtin_ctzll(bits);
+            if (off + 2 < obj.length)
+                patch_addr16(obj.image + off, delta);
         }
     }
+
+    all.off = 0;
+    all.len = obj.length / 3 * 3;
+    status = write_rlout("RLOUT.txt", obj.image, &all, 1, start_addr) < 0;
+    sicobj_free(&obj);
+    if (status)
+        return 1;
+
+    printf("\n Relocating loader finished.\n");
+    printf("\n\n--- Content of RLOUT.txt ---\n");
+    display_file_content("RLOUT.txt");
+    printf("\n");
+    return 0;
 }
 
 void display_file_content(const char *filename) {
@@ -122,6 +374,6 @@ void display_file_content(const char *filename) {
     while (fgets(line_buffer, sizeof(line_buffer), file_ptr) != NULL) {
         printf("%s", line_buffer);
     }
-    
+
     fclose(file_ptr);
 }
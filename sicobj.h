@@ -0,0 +1,257 @@
+/*
+ * Binary SIC object file format
+ *
+ * A compact alternative to the caret-separated H^T^E text program.
+ * All integers are little-endian.
+ *
+ *   Header      "SICB" magic, u8 version, 6-byte program name
+ *               (blank padded), u32 start address, u32 length
+ *   Text        u8 'T', u32 address, u16 n, n raw object bytes
+ *               (repeated; one record per contiguous run of code)
+ *   Relocation  u8 'R', u32 n, n-byte bitmap; bit i (LSB first) set
+ *               means the instruction at program offset i has a
+ *               16-bit address in its last two bytes
+ *   End         u8 'E', u32 entry address
+ *
+ * The writer buffers the whole file and writes it with one fwrite; the
+ * reader maps the file once and copies the text into a memory image,
+ * so loaders do no hex decoding at all.
+ */
+
+#ifndef SICOBJ_H
+#define SICOBJ_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SICOBJ_MAGIC "SICB"
+#define SICOBJ_VERSION 1
+#define SICOBJ_MAX_RECORD 0xFFFF
+#define SICOBJ_MAX_LENGTH 0x1000000 // 24-bit SIC/XE address space
+
+struct SicObjWriter {
+    unsigned char *buf;  // Whole file, written at sicobj_end()
+    int len, cap;
+    int rec_pos;         // Offset of the open text record's header, or -1
+    int rec_addr, rec_len;
+    int start, length;
+    unsigned char *reloc; // Relocation bitmap, one bit per program byte
+};
+
+// A loaded binary object program
+struct SicObj {
+    char name[7];
+    int start, length, entry;
+    unsigned char *image;  // 'length' bytes, image[0] is address 'start'
+    unsigned char *reloc;  // Relocation bitmap, (length + 7) / 8 bytes
+};
+
+static inline void sicobj_reserve(struct SicObjWriter *w, int n) {
+    if (w->len + n <= w->cap)
+        return;
+    while (w->len + n > w->cap)
+        w->cap *= 2;
+    w->buf = realloc(w->buf, w->cap);
+}
+
+static inline void sicobj_put_u32(struct SicObjWriter *w, unsigned v) {
+    sicobj_reserve(w, 4);
+    for (int i = 0; i < 4; i++)
+        w->buf[w->len++] = (v >> (8 * i)) & 0xFF;
+}
+
+static inline void sicobj_put_u16_at(struct SicObjWriter *w, int pos, unsigned v) {
+    w->buf[pos] = v & 0xFF;
+    w->buf[pos + 1] = (v >> 8) & 0xFF;
+}
+
+static inline unsigned sicobj_get_u32(const unsigned char *p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((unsigned)p[3] << 24);
+}
+
+// Start a binary object program
+static inline void sicobj_begin(struct SicObjWriter *w, const char *name, int start, int length) {
+    int nlen = strlen(name);
+
+    memset(w, 0, sizeof(*w));
+    w->cap = 4096;
+    w->buf = malloc(w->cap);
+    w->rec_pos = -1;
+    w->start = start;
+    w->length = length;
+    w->reloc = calloc(length / 8 + 1, 1);
+
+    memcpy(w->buf, SICOBJ_MAGIC, 4);
+    w->buf[4] = SICOBJ_VERSION;
+    w->len = 5;
+    sicobj_reserve(w, 6);
+    for (int i = 0; i < 6; i++)
+        w->buf[w->len++] = i < nlen ? name[i] : ' ';
+    sicobj_put_u32(w, start);
+    sicobj_put_u32(w, length);
+}
+
+// Close the open text record (if any)
+static inline void sicobj_break(struct SicObjWriter *w) {
+    if (w->rec_pos >= 0)
+        sicobj_put_u16_at(w, w->rec_pos + 5, w->rec_len);
+    w->rec_pos = -1;
+}
+
+// Append object bytes at 'addr'; contiguous bytes share one record
+static inline void sicobj_text(struct SicObjWriter *w, int addr, const unsigned char *bytes, int n) {
+    while (n > 0) {
+        if (w->rec_pos < 0 || addr != w->rec_addr + w->rec_len ||
+            w->rec_len == SICOBJ_MAX_RECORD) {
+            sicobj_break(w);
+            sicobj_reserve(w, 7);
+            w->rec_pos = w->len;
+            w->buf[w->len++] = 'T';
+            sicobj_put_u32(w, addr);
+            w->len += 2; // Length, filled in by sicobj_break()
+            w->rec_addr = addr;
+            w->rec_len = 0;
+        }
+        int k = SICOBJ_MAX_RECORD - w->rec_len;
+        if (k > n)
+            k = n;
+        sicobj_reserve(w, k);
+        memcpy(w->buf + w->len, bytes, k);
+        w->len += k;
+        w->rec_len += k;
+        addr += k;
+        bytes += k;
+        n -= k;
+    }
+}
+
+// Mark the instruction at 'addr' as holding a relocatable address
+static inline void sicobj_reloc(struct SicObjWriter *w, int addr) {
+    int off = addr - w->start;
+    if (off >= 0 && off < w->length)
+        w->reloc[off / 8] |= 1 << (off % 8);
+}
+
+// Finish the program and write it out in one call
+// Returns 0 on success, -1 on a write error
+static inline int sicobj_end(struct SicObjWriter *w, int entry, FILE *fp) {
+    int nbytes = (w->length + 7) / 8;
+    int ok;
+
+    sicobj_break(w);
+    sicobj_reserve(w, 5 + nbytes + 5);
+    w->buf[w->len++] = 'R';
+    sicobj_put_u32(w, nbytes);
+    memcpy(w->buf + w->len, w->reloc, nbytes);
+    w->len += nbytes;
+    w->buf[w->len++] = 'E';
+    sicobj_put_u32(w, entry);
+
+    ok = fwrite(w->buf, 1, w->len, fp) == (size_t)w->len;
+    free(w->buf);
+    free(w->reloc);
+    w->buf = w->reloc = NULL;
+    return ok ? 0 : -1;
+}
+
+// Does the file start with the binary object magic?
+static inline int sicobj_is_binary(const char *filename) {
+    char magic[4];
+    FILE *fp = fopen(filename, "rb");
+    int yes = 0;
+
+    if (fp != NULL) {
+        yes = fread(magic, 1, 4, fp) == 4 && memcmp(magic, SICOBJ_MAGIC, 4) == 0;
+        fclose(fp);
+    }
+    return yes;
+}
+
+// Map a binary object file and build its memory image
+// Returns 0 on success, -1 if the file is missing or malformed
+static inline int sicobj_read(const char *filename, struct SicObj *obj) {
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+    int ok = 0;
+
+    memset(obj, 0, sizeof(*obj));
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0 || st.st_size < 19) {
+        close(fd);
+        return -1;
+    }
+    const unsigned char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return -1;
+
+    const unsigned char *p = base, *end = base + st.st_size;
+    if (memcmp(p, SICOBJ_MAGIC, 4) != 0 || p[4] != SICOBJ_VERSION)
+        goto out;
+    memcpy(obj->name, p + 5, 6);
+    obj->name[6] = '\0';
+    for (int i = 5; i >= 0 && obj->name[i] == ' '; i--)
+        obj->name[i] = '\0';
+    uint32_t start = sicobj_get_u32(p + 11);
+    uint32_t length = sicobj_get_u32(p + 15);
+    // Check the length before anything is allocated from it
+    if (start >= SICOBJ_MAX_LENGTH || length > SICOBJ_MAX_LENGTH)
+        goto out;
+    obj->start = start;
+    obj->length = length;
+    obj->entry = obj->start;
+    obj->image = calloc(length + 1, 1);
+    obj->reloc = calloc(length / 8 + 1, 1);
+    p += 19;
+
+    while (p < end) {
+        if (*p == 'T' && end - p >= 7) {
+            uint32_t addr = sicobj_get_u32(p + 1);
+            size_t n = p[5] | (p[6] << 8);
+            p += 7;
+            if ((size_t)(end - p) < n || addr < start || n > length ||
+                addr - start > length - n)
+                goto out;
+            memcpy(obj->image + (addr - start), p, n);
+            p += n;
+        } else if (*p == 'R' && end - p >= 5) {
+            size_t n = sicobj_get_u32(p + 1);
+            p += 5;
+            if ((size_t)(end - p) < n || n > (length + 7) / 8)
+                goto out;
+            memcpy(obj->reloc, p, n);
+            p += n;
+        } else if (*p == 'E' && end - p >= 5) {
+            obj->entry = sicobj_get_u32(p + 1);
+            ok = 1;
+            break;
+        } else {
+            goto out;
+        }
+    }
+
+out:
+    munmap((void *)base, st.st_size);
+    if (!ok) {
+        free(obj->image);
+        free(obj->reloc);
+        obj->image = obj->reloc = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static inline void sicobj_free(struct SicObj *obj) {
+    free(obj->image);
+    free(obj->reloc);
+    obj->image = obj->reloc = NULL;
+}
+
+#endif
@@ -0,0 +1,125 @@
+/*
+ * Buffered H^T^E record writer
+ *
+ * Object bytes are appended to the open T-record (at most 30 bytes)
+ * with a tracked length; records are formatted straight into a large
+ * output buffer that is written with one fwrite when it fills up.
+ * Constants longer than a record are split across as many records as
+ * they need. A writer can also resume in the middle of an existing
+ * file, with a record left open (incremental reassembly, asminc.h).
+ */
+
+#ifndef TRECORD_H
+#define TRECORD_H
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#define TREC_MAX_BYTES 30
+#define TREC_PREFIX 11       // "T^AAAAAA^LL" before the hex of a record
+#define TREC_OUT_SIZE (64 * 1024)
+
+struct TRecWriter {
+    FILE *fp;
+    char *out;                          // Pending output text
+    int out_len;
+    unsigned char rec[TREC_MAX_BYTES];  // Open T-record
+    int rec_len;
+    int rec_addr;
+    int nrecords;                       // T-records written
+    long bytes_written;                 // File offset of out[0]
+};
+
+static inline void trec_flush_out(struct TRecWriter *w) {
+    if (w->out_len > 0) {
+        fwrite(w->out, 1, w->out_len, w->fp);
+        w->bytes_written += w->out_len;
+        w->out_len = 0;
+    }
+}
+
+// Room for at least one full record in the output buffer
+static inline char *trec_room(struct TRecWriter *w) {
+    if (w->out_len > TREC_OUT_SIZE - 128)
+        trec_flush_out(w);
+    return w->out + w->out_len;
+}
+
+static inline void trec_begin(struct TRecWriter *w, FILE *fp, const char *name,
+                              int start, int length) {
+    memset(w, 0, sizeof(*w));
+    w->fp = fp;
+    w->out = malloc(TREC_OUT_SIZE);
+    w->out_len = sprintf(w->out, "H^%-6s^%06X^%06X\n", name, start, length);
+}
+
+// Continue a file at offset 'pos' (where the next record goes) with
+// 'nrecords' records written and the open record 'rec' of 'len' bytes
+static inline void trec_resume(struct TRecWriter *w, FILE *fp, long pos, int nrecords,
+                               int addr, const unsigned char *rec, int len) {
+    memset(w, 0, sizeof(*w));
+    w->fp = fp;
+    w->out = malloc(TREC_OUT_SIZE);
+    w->bytes_written = pos;
+    w->nrecords = nrecords;
+    w->rec_addr = addr;
+    w->rec_len = len;
+    memcpy(w->rec, rec, len);
+}
+
+// File offset at which the open record will be written
+static inline long trec_pos(const struct TRecWriter *w) {
+    return w->bytes_written + w->out_len;
+}
+
+// Write the open T-record (if any)
+static inline void trec_break(struct TRecWriter *w) {
+    static const char hexdig[] = "0123456789ABCDEF";
+
+    if (w->rec_len == 0)
+        return;
+    char *p = trec_room(w);
+    p += sprintf(p, "T^%06X^%02X", w->rec_addr, w->rec_len);
+    for (int i = 0; i < w->rec_len; i++) {
+        *p++ = hexdig[w->rec[i] >> 4];
+        *p++ = hexdig[w->rec[i] & 15];
+    }
+    *p++ = '\n';
+    w->out_len = p - w->out;
+    w->rec_len = 0;
+    w->nrecords++;
+}
+
+// Append the object code of one line at 'addr'
+// Code that does not fit in (or does not follow) the open record starts
+// a new one
+static inline void trec_append(struct TRecWriter *w, int addr, const unsigned char *bytes, int n) {
+    if (w->rec_len + n > TREC_MAX_BYTES || (w->rec_len > 0 && addr != w->rec_addr + w->rec_len))
+        trec_break(w);
+    while (n > 0) {
+        if (w->rec_len == 0)
+            w->rec_addr = addr;
+        int k = TREC_MAX_BYTES - w->rec_len;
+        if (k > n)
+            k = n;
+        memcpy(w->rec + w->rec_len, bytes, k);
+        w->rec_len += k;
+        addr += k;
+        bytes += k;
+        n -= k;
+        if (n > 0)
+            trec_break(w); // Oversized constant: continue in a new record
+    }
+}
+
+// Write the last T-record and the E-record, then flush everything
+static inline void trec_end(struct TRecWriter *w, int entry) {
+    trec_break(w);
+    w->out_len += sprintf(trec_room(w), "E^%06X\n", entry);
+    trec_flush_out(w);
+    free(w->out);
+    w->out = NULL;
+}
+
+#endif